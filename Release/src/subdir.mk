@@ -4,21 +4,48 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 CPP_SRCS += \
+../src/CNF.cpp \
+../src/Checkpoint.cpp \
+../src/ColumnKernel.cpp \
 ../src/DNF.cpp \
+../src/DNFArena.cpp \
 ../src/Knowledge.cpp \
+../src/Log.cpp \
+../src/MappedFile.cpp \
 ../src/Problem.cpp \
+../src/PropagationContext.cpp \
+../src/Statistics.cpp \
+../src/ThreadPool.cpp \
 ../src/main.cpp 
 
 OBJS += \
+./src/CNF.o \
+./src/Checkpoint.o \
+./src/ColumnKernel.o \
 ./src/DNF.o \
+./src/DNFArena.o \
 ./src/Knowledge.o \
+./src/Log.o \
+./src/MappedFile.o \
 ./src/Problem.o \
+./src/PropagationContext.o \
+./src/Statistics.o \
+./src/ThreadPool.o \
 ./src/main.o 
 
 CPP_DEPS += \
+./src/CNF.d \
+./src/Checkpoint.d \
+./src/ColumnKernel.d \
 ./src/DNF.d \
+./src/DNFArena.d \
 ./src/Knowledge.d \
+./src/Log.d \
+./src/MappedFile.d \
 ./src/Problem.d \
+./src/PropagationContext.d \
+./src/Statistics.d \
+./src/ThreadPool.d \
 ./src/main.d 
 
 
@@ -26,7 +53,7 @@ CPP_DEPS += \
 src/%.o: ../src/%.cpp
 	@echo 'Building file: $<'
 	@echo 'Invoking: Cross G++ Compiler'
-	g++ -std=c++11 -O3 -pedantic -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@:%.o=%.d)" -o "$@" "$<"
+	g++ -std=c++11 -O3 -pthread -pedantic -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@:%.o=%.d)" -o "$@" "$<"
 	@echo 'Finished building: $<'
 	@echo ' '
 
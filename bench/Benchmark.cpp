@@ -0,0 +1,398 @@
+// Times the solver's kernels on seeded synthetic functions and writes the
+// results as JSON, so two builds can be compared on exactly the same inputs.
+//
+// Usage: benchmark [--seed N] [--min-time SECONDS] [--filter TEXT] [--threads N] [--output FILE]
+
+#include "../src/DNF.h"
+#include "../src/Knowledge.h"
+#include "../src/Log.h"
+#include "../src/Problem.h"
+#include "../src/ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <unistd.h>
+#include <vector>
+using std::string;
+using std::vector;
+
+// Each result is the median and minimum of this many timed samples
+const size_t SAMPLES = 5;
+
+struct Settings {
+  uint64_t seed = 1;
+  double min_time = 0.25;
+  string filter;
+};
+
+struct Result {
+  string name;
+  // Parameters of the case, such as "variables" and "rows"
+  vector<std::pair<string, size_t>> parameters;
+  size_t iterations;
+  double median_ns, min_ns;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Stops the compiler from removing work whose result is never used
+volatile size_t sink;
+void keep(size_t value) {
+  sink = value;
+}
+
+class Runner {
+ public:
+  explicit Runner(const Settings& settings_) : settings(settings_) {
+  }
+  // Times "body", which performs one operation per call
+  void run(const string& name, const vector<std::pair<string, size_t>>& parameters,
+           const std::function<void()>& body) {
+    if (name.find(settings.filter) == string::npos) {
+      return;
+    }
+    // Find how many calls fill a sample, starting from a single warm up call
+    size_t iterations = 1;
+    while (true) {
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t i=0; i < iterations; i++) {
+        body();
+      }
+      const double elapsed = seconds_since(start);
+      if (elapsed * SAMPLES >= settings.min_time or iterations >= (size_t(1) << 30)) {
+        break;
+      }
+      const double growth = elapsed > 0 ? settings.min_time / SAMPLES / elapsed : 100;
+      iterations = size_t(iterations * std::max(2.0, std::min(100.0, growth)));
+    }
+    vector<double> samples;
+    for (size_t s=0; s < SAMPLES; s++) {
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t i=0; i < iterations; i++) {
+        body();
+      }
+      samples.push_back(seconds_since(start) * 1e9 / iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+    results.push_back({name, parameters, iterations, samples[SAMPLES / 2], samples[0]});
+    std::cerr << name;
+    for (const auto& parameter : parameters) {
+      std::cerr << " " << parameter.first << "=" << parameter.second;
+    }
+    std::cerr << ": " << samples[SAMPLES / 2] << " ns" << std::endl;
+  }
+  const vector<Result>& get_results() const {
+    return results;
+  }
+ private:
+  const Settings& settings;
+  vector<Result> results;
+};
+
+// A function of "variables" variables (numbered from 1) with "rows" random distinct rows.
+// Variable 1 is always 1 and variable 3 always equals variable 2, so there is
+// something for "create_knowledge" to find.
+DNF random_dnf(std::mt19937_64& random, size_t first_variable, size_t variables, size_t rows) {
+  vector<size_t> names(variables);
+  for (size_t i=0; i < variables; i++) {
+    names[i] = first_variable + i;
+  }
+  vector<vector<bool>> table;
+  std::unordered_set<uint64_t> seen;
+  // Only the free columns (after the first three) make rows distinct
+  const size_t free_bits = variables > 3 ? variables - 3 : 0;
+  const uint64_t free_mask = free_bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << free_bits) - 1;
+  rows = std::min<uint64_t>(rows, free_mask + 1);
+  while (table.size() < rows) {
+    const uint64_t free = random() & free_mask;
+    if (not seen.insert(free).second) {
+      continue;
+    }
+    vector<bool> row(variables);
+    row[0] = true;
+    if (variables > 2) {
+      row[1] = row[2] = random() & 1;
+    }
+    for (size_t c=3; c < variables; c++) {
+      row[c] = (free >> (c - 3)) & 1;
+    }
+    table.push_back(row);
+  }
+  return DNF(names, table);
+}
+
+// Knowledge about "total" random variables in [1, variables]
+Knowledge random_knowledge(std::mt19937_64& random, size_t variables, size_t total, bool rewrites) {
+  Knowledge knowledge;
+  for (size_t i=0; i < total; i++) {
+    const size_t a = 1 + random() % variables;
+    const size_t b = 1 + random() % variables;
+    if (rewrites and a != b) {
+      knowledge.add(TwoConsistency(a, b, random() & 1));
+    } else if (not rewrites) {
+      knowledge.add(a, random() & 1);
+    }
+  }
+  return knowledge;
+}
+
+// Writes a planted instance with "variables" variables and as many functions of 3 to 6 variables
+string write_instance(std::mt19937_64& random, size_t variables) {
+  char filename[] = "/tmp/fastsat_benchXXXXXX";
+  const int descriptor = mkstemp(filename);
+  close(descriptor);
+  string name = string(filename) + ".dnf";
+  std::rename(filename, name.c_str());
+  std::ofstream out(name);
+  vector<bool> planted(variables + 1);
+  for (size_t v=1; v <= variables; v++) {
+    planted[v] = random() & 1;
+  }
+  out << "p dnf " << variables << " " << variables << "\nc benchmark\n";
+  for (size_t f=0; f < variables; f++) {
+    const size_t size = 3 + random() % 4;
+    vector<size_t> chosen;
+    while (chosen.size() < size) {
+      const size_t v = 1 + random() % variables;
+      if (std::find(chosen.begin(), chosen.end(), v) == chosen.end()) {
+        chosen.push_back(v);
+      }
+    }
+    uint64_t position = 0;
+    for (size_t i=0; i < size; i++) {
+      position |= uint64_t(planted[chosen[i]]) << i;
+    }
+    // The planted assignment plus roughly half of the others
+    const uint64_t positions = size == 6 ? ~uint64_t(0) : (uint64_t(1) << (uint64_t(1) << size)) - 1;
+    const uint64_t table = (random() & positions) | (uint64_t(1) << position);
+    out << "******* Big integer: " << table << " , Block size = " << size << "\n";
+    for (size_t i=0; i < size; i++) {
+      out << chosen[i] << (i + 1 < size ? " " : "\n");
+    }
+  }
+  return name;
+}
+
+void benchmark_dnf(Runner& runner, uint64_t seed) {
+  const size_t variable_counts[] = {4, 8, 16, 32};
+  const size_t row_counts[] = {16, 256, 4096, 65536};
+  for (const auto variables : variable_counts) {
+    for (const auto rows : row_counts) {
+      if (variables < 63 and rows > (uint64_t(1) << variables)) {
+        continue;
+      }
+      std::mt19937_64 random(seed);
+      const DNF dnf = random_dnf(random, 1, variables, rows);
+      const vector<std::pair<string, size_t>> parameters = {{"variables", variables}, {"rows", dnf.total_rows()}};
+      runner.run("DNF::create_knowledge", parameters, [&] {
+        keep(dnf.create_knowledge().assigned_count());
+      });
+      runner.run("DNF::create_knowledge_alternate", parameters, [&] {
+        keep(dnf.create_knowledge_alternate().assigned_count());
+      });
+      // The copy is timed alone so it can be subtracted from "apply_knowledge"
+      runner.run("DNF copy", parameters, [&] {
+        DNF copy = dnf;
+        keep(copy.total_rows());
+      });
+      Knowledge knowledge;
+      knowledge.add(variables, false);
+      if (variables >= 6) {
+        knowledge.add(TwoConsistency(5, 4, true));
+      }
+      runner.run("DNF::apply_knowledge (with copy)", parameters, [&] {
+        DNF copy = dnf;
+        copy.apply_knowledge(knowledge);
+        keep(copy.total_rows());
+      });
+      // Merge with a function sharing half of its variables
+      const DNF other = random_dnf(random, 1 + variables / 2, variables, rows);
+      runner.run("DNF::merge", parameters, [&] {
+        keep(DNF::merge(dnf, other).total_rows());
+      });
+    }
+  }
+}
+
+void benchmark_knowledge(Runner& runner, uint64_t seed) {
+  const size_t sizes[] = {64, 1024, 16384};
+  for (const auto size : sizes) {
+    std::mt19937_64 random(seed);
+    const vector<std::pair<string, size_t>> parameters = {{"facts", size}};
+    vector<size_t> variables(size);
+    vector<bool> values(size);
+    vector<TwoConsistency> rewrites(size);
+    for (size_t i=0; i < size; i++) {
+      variables[i] = 1 + random() % (4 * size);
+      values[i] = random() & 1;
+      rewrites[i] = TwoConsistency(1 + random() % (4 * size), 1 + random() % (4 * size), random() & 1);
+    }
+    UpdatedVariables updated;
+    runner.run("Knowledge::add(variable, value)", parameters, [&] {
+      Knowledge knowledge;
+      for (size_t i=0; i < size; i++) {
+        updated.clear();
+        knowledge.add(variables[i], values[i], &updated);
+        keep(updated.size());
+      }
+    });
+    runner.run("Knowledge::add(TwoConsistency)", parameters, [&] {
+      Knowledge knowledge;
+      for (size_t i=0; i < size; i++) {
+        if (rewrites[i].from != rewrites[i].to) {
+          updated.clear();
+          knowledge.add(rewrites[i], &updated);
+          keep(updated.size());
+        }
+      }
+    });
+    const Knowledge assignments = random_knowledge(random, 4 * size, size / 2, false);
+    const Knowledge equalities = random_knowledge(random, 4 * size, size / 2, true);
+    runner.run("Knowledge::add(Knowledge)", parameters, [&] {
+      Knowledge knowledge = equalities;
+      updated.clear();
+      knowledge.add(assignments, &updated);
+      keep(updated.size());
+    });
+  }
+}
+
+void benchmark_problem(Runner& runner, uint64_t seed) {
+  const size_t sizes[] = {100, 1000, 10000};
+  for (const auto variables : sizes) {
+    std::mt19937_64 random(seed);
+    const string filename = write_instance(random, variables);
+    Problem problem;
+    problem.load(filename);
+    std::remove(filename.c_str());
+    size_t next = 0;
+    runner.run("Problem::propagate_assumption", {{"variables", variables}}, [&] {
+      Knowledge assumption;
+      assumption.add(1 + next, next & 1);
+      next = (next + 7919) % variables;
+      problem.propagate_assumption(assumption);
+      keep(assumption.assigned_count());
+    });
+  }
+}
+
+// Times the parallel paths with 1, 2, 4, ... threads, up to the size the global
+// pool started with, so speedup against cores can be read from the results
+void benchmark_scaling(Runner& runner, uint64_t seed) {
+  const size_t max_threads = ThreadPool::global().size();
+  vector<size_t> thread_counts;
+  for (size_t threads=1; threads < max_threads; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+  thread_counts.push_back(max_threads);
+  std::mt19937_64 random(seed);
+  // Large enough to be split across the pool (see DNF::parallel_merge_rows)
+  const DNF dnf = random_dnf(random, 1, 32, 65536);
+  const DNF other = random_dnf(random, 17, 32, 65536);
+  const size_t variables = 10000;
+  const string filename = write_instance(random, variables);
+  for (const auto threads : thread_counts) {
+    ThreadPool::set_global_size(threads);
+    runner.run("scaling DNF::merge", {{"threads", threads}, {"rows", dnf.total_rows()}}, [&] {
+      keep(DNF::merge(dnf, other).total_rows());
+    });
+    // Propagating changes the problem, so each call loads it again. The load is
+    // timed alone so it can be subtracted.
+    runner.run("scaling Problem::load", {{"threads", threads}, {"variables", variables}}, [&] {
+      Problem problem;
+      problem.load(filename);
+      keep(problem.dnfs.size());
+    });
+    runner.run("scaling Problem::knowledge_propagate (with load)", {{"threads", threads}, {"variables", variables}}, [&] {
+      Problem problem;
+      problem.load(filename);
+      problem.knowledge_propagate();
+      keep(problem.global_knowledge.assigned_count());
+    });
+  }
+  std::remove(filename.c_str());
+  ThreadPool::set_global_size(max_threads);
+}
+
+// Escapes the characters JSON does not allow in strings
+string json_string(const string& text) {
+  string result = "\"";
+  for (const char c : text) {
+    if (c == '"' or c == '\\') {
+      result += '\\';
+    }
+    result += c;
+  }
+  return result + "\"";
+}
+
+void write_json(std::ostream& out, const Settings& settings, const vector<Result>& results) {
+  out << "{\n  \"settings\": {\"seed\": " << settings.seed << ", \"min_time\": " << settings.min_time
+      << ", \"threads\": " << ThreadPool::global().size() << ", \"compiler\": " << json_string(__VERSION__)
+#ifdef __OPTIMIZE__
+      << ", \"optimized\": true"
+#else
+      << ", \"optimized\": false"
+#endif
+      << "},\n  \"results\": [";
+  for (size_t i=0; i < results.size(); i++) {
+    const auto& result = results[i];
+    out << (i ? ",\n" : "\n") << "    {\"name\": " << json_string(result.name);
+    for (const auto& parameter : result.parameters) {
+      out << ", " << json_string(parameter.first) << ": " << parameter.second;
+    }
+    out << ", \"iterations\": " << result.iterations << ", \"median_ns\": " << result.median_ns
+        << ", \"min_ns\": " << result.min_ns << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int main(int argc, char * argv[]) {
+  Settings settings;
+  string output;
+  for (int i=1; i < argc; i++) {
+    const string argument = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << argument << std::endl;
+      return 1;
+    }
+    if (argument == "--seed") {
+      settings.seed = std::stoull(argv[++i]);
+    } else if (argument == "--min-time") {
+      settings.min_time = std::stod(argv[++i]);
+    } else if (argument == "--filter") {
+      settings.filter = argv[++i];
+    } else if (argument == "--threads") {
+      ThreadPool::set_global_size(std::stoul(argv[++i]));
+    } else if (argument == "--output") {
+      output = argv[++i];
+    } else {
+      std::cerr << "Unknown option " << argument << std::endl;
+      return 1;
+    }
+  }
+  // Only timing the solver, not its progress messages
+  Log::set_level(LOG_ERROR);
+  Runner runner(settings);
+  benchmark_dnf(runner, settings.seed);
+  benchmark_knowledge(runner, settings.seed);
+  benchmark_problem(runner, settings.seed);
+  benchmark_scaling(runner, settings.seed);
+
+  if (output.empty()) {
+    write_json(std::cout, settings, runner.get_results());
+  } else {
+    std::ofstream out(output);
+    write_json(out, settings, runner.get_results());
+  }
+  return 0;
+}
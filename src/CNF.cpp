@@ -0,0 +1,293 @@
+#include "CNF.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Bytes of the file parsed by each task
+const size_t CNF_CHUNK_BYTES = 1 << 20;
+// How many of the most recent groups containing a variable are considered for a new clause
+const size_t GROUP_CANDIDATES = 4;
+
+struct ClauseGroup {
+  // Sorted, and in the order they become the function's columns
+  vector<size_t> variables;
+  // For each variable, the group it was added to before this one, or NO_GROUP
+  vector<size_t> previous;
+  // Where each of this group's clauses starts in "ClauseChunk::clauses"
+  vector<size_t> clauses;
+};
+const size_t NO_GROUP = ~size_t(0);
+
+// The last group a variable was added to, and which chunk that group is in
+struct LatestGroup {
+  uint32_t chunk;
+  uint32_t group;
+};
+
+// One piece of the file, starting at the beginning of a line
+struct ClauseChunk {
+  const char* begin;
+  const char* end;
+  // Lines this chunk covers, known once it has been parsed without error
+  size_t lines = 0;
+  bool failed = false;
+  // True if a line starting with '%' ended the clauses in this chunk
+  bool finished = false;
+  // Literals in file order, with each clause ended by a 0
+  vector<int64_t> literals;
+  // The same clauses sorted by variable, without repeated literals or tautologies
+  vector<int64_t> clauses;
+  vector<ClauseGroup> groups;
+};
+
+void parse_chunk(ClauseChunk& chunk, const string& filename, size_t first_line, size_t total_variables) {
+  Scanner in(chunk.begin, chunk.end, filename, first_line);
+  while (not in.at_end()) {
+    const char next = in.peek();
+    if (next == '\n' or next == 'c') {
+      in.next_line();
+      continue;
+    }
+    // Some benchmark sets end their clauses with a '%' line
+    if (next == '%') {
+      chunk.finished = true;
+      break;
+    }
+    const int64_t literal = in.read_integer();
+    const size_t variable = literal < 0 ? -literal : literal;
+    if (variable > total_variables) {
+      in.error("variable " + std::to_string(variable) + " is not in 1.." + std::to_string(total_variables));
+    }
+    chunk.literals.push_back(literal);
+  }
+  chunk.lines = in.line() - first_line;
+}
+
+size_t variable_of(int64_t literal) {
+  return literal < 0 ? -literal : literal;
+}
+
+bool by_variable(int64_t a, int64_t b) {
+  const size_t va = variable_of(a), vb = variable_of(b);
+  return va < vb or (va == vb and a < b);
+}
+
+// Number of distinct values in two sorted lists
+size_t union_size(const vector<size_t>& a, const vector<size_t>& b) {
+  size_t i = 0, j = 0, total = 0;
+  while (i < a.size() and j < b.size()) {
+    if (a[i] < b[j]) {
+      i++;
+    } else if (b[j] < a[i]) {
+      j++;
+    } else {
+      i++;
+      j++;
+    }
+    total++;
+  }
+  return total + (a.size() - i) + (b.size() - j);
+}
+
+// Greedily puts each clause into the group whose scope it grows the least,
+// starting a new group if every choice would go over "group_limit". Only the
+// most recent groups containing each of the clause's variables are considered,
+// found by following "previous" back from "latest", which is indexed by variable
+// and only trusted for entries tagged with "chunk_number".
+void group_chunk(ClauseChunk& chunk, uint32_t chunk_number, vector<LatestGroup>& latest, size_t group_limit) {
+  vector<int64_t> clause;
+  vector<size_t> scope;
+  for (auto it = chunk.literals.begin(); it != chunk.literals.end(); it++) {
+    if (*it != 0) {
+      clause.push_back(*it);
+      continue;
+    }
+    std::sort(clause.begin(), clause.end(), by_variable);
+    clause.erase(std::unique(clause.begin(), clause.end()), clause.end());
+    scope.clear();
+    bool tautology = false;
+    for (const auto literal : clause) {
+      if (not scope.empty() and scope.back() == variable_of(literal)) {
+        tautology = true;
+        break;
+      }
+      scope.push_back(variable_of(literal));
+    }
+    if (tautology) {
+      clause.clear();
+      continue;
+    }
+    size_t best = chunk.groups.size(), best_size = group_limit + 1;
+    for (const auto v : scope) {
+      size_t g = latest[v].chunk == chunk_number ? latest[v].group : NO_GROUP;
+      for (size_t i=0; i < GROUP_CANDIDATES and g != NO_GROUP; i++) {
+        const auto& candidate = chunk.groups[g];
+        const size_t size = union_size(candidate.variables, scope);
+        if (size <= group_limit and (size < best_size or (size == best_size and g < best))) {
+          best = g;
+          best_size = size;
+        }
+        const size_t column = std::lower_bound(candidate.variables.begin(), candidate.variables.end(), v)
+            - candidate.variables.begin();
+        g = candidate.previous[column];
+      }
+    }
+    if (best == chunk.groups.size()) {
+      chunk.groups.emplace_back();
+      chunk.groups.back().variables.reserve(std::max(scope.size(), group_limit));
+      chunk.groups.back().previous.reserve(std::max(scope.size(), group_limit));
+    }
+    auto& group = chunk.groups[best];
+    for (const auto v : scope) {
+      const auto position = std::lower_bound(group.variables.begin(), group.variables.end(), v);
+      if (position == group.variables.end() or *position != v) {
+        const size_t previous = latest[v].chunk == chunk_number ? latest[v].group : NO_GROUP;
+        group.previous.insert(group.previous.begin() + (position - group.variables.begin()), previous);
+        group.variables.insert(position, v);
+        latest[v] = {chunk_number, uint32_t(best)};
+      }
+    }
+    group.clauses.push_back(chunk.clauses.size());
+    chunk.clauses.insert(chunk.clauses.end(), clause.begin(), clause.end());
+    chunk.clauses.push_back(0);
+    clause.clear();
+  }
+  chunk.literals.clear();
+  chunk.literals.shrink_to_fit();
+}
+
+// Builds the truth table of every assignment to the group's variables that
+// satisfies all of its clauses, by removing each clause's falsifying assignments
+DNF enumerate_group(const ClauseGroup& group, const vector<int64_t>& clauses) {
+  const size_t size = group.variables.size();
+  const size_t total_words = size <= SMALL_LIMIT ? 1 : size_t(1) << (size - SMALL_LIMIT);
+  vector<uint64_t> truth(total_words, ~uint64_t(0));
+  for (const auto start : group.clauses) {
+    for (size_t w=0; w < total_words; w++) {
+      uint64_t falsified = ~uint64_t(0);
+      for (size_t i=start; clauses[i] != 0 and falsified; i++) {
+        const size_t column = std::lower_bound(group.variables.begin(), group.variables.end(),
+                                               variable_of(clauses[i])) - group.variables.begin();
+        // A positive literal is false where its variable is 0
+        const bool false_value = clauses[i] < 0;
+        if (column < SMALL_LIMIT) {
+          const uint64_t ones = small_variable_mask(column);
+          falsified &= false_value ? ones : ~ones;
+        } else if (((w >> (column - SMALL_LIMIT)) & 1) != false_value) {
+          falsified = 0;
+        }
+      }
+      truth[w] &= ~falsified;
+    }
+  }
+  return DNF(group.variables, truth);
+}
+
+vector<DNF> read_cnf(const string& filename, size_t group_limit, size_t& total_variables) {
+  MappedFile file(filename);
+  Scanner in(file.begin(), file.end(), filename);
+  // Comments may come before the header
+  while (not in.at_end() and (in.peek() == 'c' or in.peek() == '\n')) {
+    in.next_line();
+  }
+  in.expect("p");
+  in.expect("cnf");
+  total_variables = in.read_unsigned();
+  const size_t total_clauses = in.read_unsigned();
+  if (not in.at_line_end()) {
+    in.error("unexpected text after the header");
+  }
+  in.next_line();
+  const size_t body_line = in.line();
+
+  // Cut the rest of the file into chunks which each end at a line break
+  vector<ClauseChunk> chunks;
+  for (const char* start = in.current(); start != file.end();) {
+    const char* stop = file.end();
+    if (size_t(file.end() - start) > CNF_CHUNK_BYTES) {
+      const char* found = static_cast<const char*>(memchr(start + CNF_CHUNK_BYTES, '\n',
+                                                          file.end() - start - CNF_CHUNK_BYTES));
+      stop = found == nullptr ? file.end() : found + 1;
+    }
+    chunks.emplace_back();
+    chunks.back().begin = start;
+    chunks.back().end = stop;
+    start = stop;
+  }
+
+  auto& pool = ThreadPool::global();
+  // Line numbers are only known after the chunks before have been read, so each
+  // chunk is first parsed without them, and any chunk that fails is parsed again
+  // to report the error
+  pool.parallel_for(chunks.size(), [&](size_t i) {
+    try {
+      parse_chunk(chunks[i], filename, 1, total_variables);
+    } catch (const std::invalid_argument&) {
+      chunks[i].failed = true;
+    }
+  });
+  size_t first_line = body_line, used = 0;
+  while (used < chunks.size()) {
+    auto& chunk = chunks[used++];
+    if (chunk.failed) {
+      chunk.literals.clear();
+      parse_chunk(chunk, filename, first_line, total_variables);
+    }
+    first_line += chunk.lines;
+    if (chunk.finished) {
+      break;
+    }
+  }
+  chunks.resize(used);
+
+  // A clause can cross into the next chunk, so move any unfinished clause forward
+  vector<int64_t> carry;
+  size_t found_clauses = 0;
+  for (auto& chunk : chunks) {
+    chunk.literals.insert(chunk.literals.begin(), carry.begin(), carry.end());
+    const auto last_zero = std::find(chunk.literals.rbegin(), chunk.literals.rend(), 0).base();
+    carry.assign(last_zero, chunk.literals.end());
+    chunk.literals.erase(last_zero, chunk.literals.end());
+    found_clauses += std::count(chunk.literals.begin(), chunk.literals.end(), 0);
+  }
+  // Allow the final 0 to be left off
+  if (not carry.empty()) {
+    chunks.back().literals.insert(chunks.back().literals.end(), carry.begin(), carry.end());
+    chunks.back().literals.push_back(0);
+    found_clauses++;
+  }
+  if (found_clauses != total_clauses) {
+    throw std::invalid_argument(filename + ": header promised " + std::to_string(total_clauses)
+                                + " clauses but found " + std::to_string(found_clauses));
+  }
+
+  // Each thread keeps its own index from variables to groups
+  vector<vector<LatestGroup>> latest(pool.size());
+  pool.parallel_for(chunks.size(), [&](size_t i) {
+    auto& index = latest[ThreadPool::worker_index()];
+    if (index.empty()) {
+      index.resize(total_variables + 1);
+    }
+    group_chunk(chunks[i], i + 1, index, group_limit);
+  });
+  // Every group is enumerated independently, but kept in file order
+  vector<std::pair<size_t, size_t>> all_groups;
+  for (size_t c=0; c < chunks.size(); c++) {
+    for (size_t g=0; g < chunks[c].groups.size(); g++) {
+      const size_t width = chunks[c].groups[g].variables.size();
+      if (width > MAX_BLOCK_SIZE) {
+        throw std::invalid_argument(filename + ": a clause has " + std::to_string(width)
+                                    + " variables, more than " + std::to_string(MAX_BLOCK_SIZE));
+      }
+      all_groups.emplace_back(c, g);
+    }
+  }
+  vector<DNF> result(all_groups.size());
+  pool.parallel_for(all_groups.size(), [&](size_t i) {
+    const auto& chunk = chunks[all_groups[i].first];
+    result[i] = enumerate_group(chunk.groups[all_groups[i].second], chunk.clauses);
+  });
+  return result;
+}
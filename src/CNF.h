@@ -0,0 +1,21 @@
+// Reads DIMACS .cnf files. Clauses whose variables fit in a small shared scope
+// are grouped into a single function, whose rows are every assignment to that
+// scope satisfying all of the group's clauses. Large files are cut into chunks
+// which are parsed and grouped in parallel. Chunks are a fixed number of bytes,
+// so the functions produced never depend on the number of threads.
+#ifndef CNF_H_
+#define CNF_H_
+
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+#include "DNF.h"
+
+// Returns one function per group of clauses in file order, and sets
+// "total_variables" from the header. Groups have at most "group_limit"
+// variables, unless a single clause is wider than that.
+vector<DNF> read_cnf(const string& filename, size_t group_limit, size_t& total_variables);
+
+#endif /* CNF_H_ */
@@ -0,0 +1,155 @@
+#include "Checkpoint.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+
+// "FSATCKPT" read as a little-endian word
+const uint64_t CHECKPOINT_MAGIC = 0x54504B4354415346ULL;
+const size_t HEADER_WORDS = 4;
+// Words written to the file at a time
+const size_t BUFFER_WORDS = 1 << 17;
+const uint64_t CHECKSUM_SEED = 0x243F6A8885A308D3ULL;
+
+// Mixes one word into a running checksum
+uint64_t checksum_step(uint64_t checksum, uint64_t word) {
+  checksum = ((checksum << 23) | (checksum >> 41)) ^ word;
+  return checksum * 0x9E3779B97F4A7C15ULL;
+}
+
+// Writes all of "bytes" at "offset", retrying short writes
+void write_fully(int descriptor, const void* data, size_t bytes, off_t offset, const string& filename) {
+  const char* remaining = static_cast<const char*>(data);
+  while (bytes > 0) {
+    const ssize_t written = pwrite(descriptor, remaining, bytes, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::system_error(errno, std::generic_category(), "Unable to write '" + filename + "'");
+    }
+    remaining += written;
+    bytes -= written;
+    offset += written;
+  }
+}
+
+CheckpointWriter::CheckpointWriter(const string& filename_)
+    : filename(filename_), temporary(filename_ + ".partial"), buffer(BUFFER_WORDS), checksum(CHECKSUM_SEED) {
+  descriptor = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (descriptor < 0) {
+    throw std::system_error(errno, std::generic_category(), "Unable to create '" + temporary + "'");
+  }
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  // Only reached with an open file if "finish" never completed
+  if (descriptor >= 0) {
+    close(descriptor);
+    unlink(temporary.c_str());
+  }
+}
+
+void CheckpointWriter::flush() {
+  for (size_t i=0; i < used; i++) {
+    checksum = checksum_step(checksum, buffer[i]);
+  }
+  write_fully(descriptor, buffer.data(), used * sizeof(uint64_t),
+              (HEADER_WORDS + total_words) * sizeof(uint64_t), temporary);
+  total_words += used;
+  used = 0;
+}
+
+void CheckpointWriter::write(uint64_t value) {
+  if (used == buffer.size()) {
+    flush();
+  }
+  buffer[used++] = value;
+}
+
+void CheckpointWriter::write(const void* data, size_t bytes) {
+  const char* remaining = static_cast<const char*>(data);
+  while (bytes > 0) {
+    if (used == buffer.size()) {
+      flush();
+    }
+    const size_t room = (buffer.size() - used) * sizeof(uint64_t);
+    const size_t taken = bytes < room ? bytes : room;
+    const size_t taken_words = (taken + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    // Pads the final word with zeros
+    buffer[used + taken_words - 1] = 0;
+    memcpy(buffer.data() + used, remaining, taken);
+    used += taken_words;
+    remaining += taken;
+    bytes -= taken;
+  }
+}
+
+void CheckpointWriter::finish() {
+  flush();
+  const uint64_t header[HEADER_WORDS] = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, total_words, checksum};
+  write_fully(descriptor, header, sizeof(header), 0, temporary);
+  if (close(descriptor) != 0) {
+    descriptor = -1;
+    unlink(temporary.c_str());
+    throw std::system_error(errno, std::generic_category(), "Unable to write '" + temporary + "'");
+  }
+  descriptor = -1;
+  if (rename(temporary.c_str(), filename.c_str()) != 0) {
+    const int error = errno;
+    unlink(temporary.c_str());
+    throw std::system_error(error, std::generic_category(), "Unable to create '" + filename + "'");
+  }
+}
+
+CheckpointReader::CheckpointReader(const string& filename) : name(filename), file(filename) {
+  if (file.size() < HEADER_WORDS * sizeof(uint64_t) or file.size() % sizeof(uint64_t) != 0) {
+    error("not a checkpoint");
+  }
+  // Mappings are page aligned, so the words can be read in place
+  const uint64_t* header = reinterpret_cast<const uint64_t*>(file.begin());
+  if (header[0] != CHECKPOINT_MAGIC) {
+    error("not a checkpoint");
+  }
+  if (header[1] != CHECKPOINT_VERSION) {
+    error("checkpoint version " + std::to_string(header[1]) + " cannot be read by version "
+          + std::to_string(CHECKPOINT_VERSION));
+  }
+  position = header + HEADER_WORDS;
+  finish = reinterpret_cast<const uint64_t*>(file.end());
+  if (header[2] != uint64_t(finish - position)) {
+    error("checkpoint is truncated");
+  }
+  uint64_t checksum = CHECKSUM_SEED;
+  for (const uint64_t* word = position; word != finish; word++) {
+    checksum = checksum_step(checksum, *word);
+  }
+  if (checksum != header[3]) {
+    error("checkpoint is corrupt");
+  }
+}
+
+void CheckpointReader::error(const string& message) const {
+  throw std::invalid_argument(name + ": " + message);
+}
+
+uint64_t CheckpointReader::read() {
+  if (at_end()) {
+    error("checkpoint ended early");
+  }
+  return *position++;
+}
+
+void CheckpointReader::read(void* data, size_t bytes) {
+  const size_t words = (bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+  if (words > size_t(finish - position)) {
+    error("checkpoint ended early");
+  }
+  if (bytes > 0) {
+    memcpy(data, position, bytes);
+  }
+  position += words;
+}
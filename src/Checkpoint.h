@@ -0,0 +1,79 @@
+// Binary snapshots of solver state. A checkpoint is a four word header (magic,
+// version, payload length in words, checksum of the payload) followed by the
+// payload, written as 64-bit words so it can be read back in place from a
+// memory mapping. Arrays are stored as their length followed by their raw bytes
+// padded to a whole word, so the format is only portable between builds with
+// the same data layout; CHECKPOINT_VERSION must change whenever that layout does.
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <cstdint>
+#include <string>
+using std::string;
+#include <type_traits>
+#include <vector>
+using std::vector;
+
+#include "MappedFile.h"
+
+const uint32_t CHECKPOINT_VERSION = 1;
+
+class CheckpointWriter {
+ public:
+  // Nothing appears at "filename" until "finish" succeeds
+  explicit CheckpointWriter(const string& filename);
+  ~CheckpointWriter();
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+  void write(uint64_t value);
+  void write(const void* data, size_t bytes);
+  template <class T>
+  void write_vector(const vector<T>& values) {
+    static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be written directly");
+    write(values.size());
+    write(values.data(), values.size() * sizeof(T));
+  }
+  // Writes the header and moves the file into place
+  void finish();
+ private:
+  string filename, temporary;
+  int descriptor = -1;
+  // Words are collected here and written out in large blocks
+  vector<uint64_t> buffer;
+  size_t used = 0;
+  uint64_t checksum;
+  uint64_t total_words = 0;
+  void flush();
+};
+
+class CheckpointReader {
+ public:
+  // Maps the file and verifies its header and checksum
+  explicit CheckpointReader(const string& filename);
+  uint64_t read();
+  void read(void* data, size_t bytes);
+  template <class T>
+  void read_vector(vector<T>& values) {
+    static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be read directly");
+    const uint64_t length = read();
+    if (length > remaining_bytes() / sizeof(T)) {
+      error("array is longer than the rest of the file");
+    }
+    values.resize(length);
+    read(values.data(), length * sizeof(T));
+  }
+  bool at_end() const {
+    return position == finish;
+  }
+  [[noreturn]] void error(const string& message) const;
+ private:
+  string name;
+  MappedFile file;
+  const uint64_t* position;
+  const uint64_t* finish;
+  size_t remaining_bytes() const {
+    return (finish - position) * sizeof(uint64_t);
+  }
+};
+
+#endif /* CHECKPOINT_H_ */
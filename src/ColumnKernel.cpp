@@ -0,0 +1,234 @@
+#include "ColumnKernel.h"
+#include <unordered_map>
+using std::unordered_map;
+using std::vector;
+#include <immintrin.h>
+
+// Combines the "differ" and "match" results into COLUMNS_* bits
+unsigned column_bits(bool differ, bool match) {
+  return (differ ? COLUMNS_DIFFER : 0) | (match ? COLUMNS_MATCH : 0);
+}
+
+size_t scalar_count(const uint64_t* column, const uint64_t* mask, size_t words) {
+  size_t total = 0;
+  for (size_t w=0; w < words; w++) {
+    total += __builtin_popcountll(column[w] & mask[w]);
+  }
+  return total;
+}
+
+unsigned scalar_compare(const uint64_t* a, const uint64_t* b, const uint64_t* mask, size_t words) {
+  uint64_t differ = 0, match = 0;
+  for (size_t w=0; w < words; w++) {
+    const uint64_t x = a[w] ^ b[w];
+    differ |= x & mask[w];
+    match |= ~x & mask[w];
+    if (differ and match) {
+      break;
+    }
+  }
+  return column_bits(differ, match);
+}
+
+__attribute__((target("sse4.1,popcnt")))
+size_t sse4_count(const uint64_t* column, const uint64_t* mask, size_t words) {
+  size_t total = 0;
+  for (size_t w=0; w < words; w++) {
+    total += _mm_popcnt_u64(column[w] & mask[w]);
+  }
+  return total;
+}
+
+__attribute__((target("sse4.1")))
+unsigned sse4_compare(const uint64_t* a, const uint64_t* b, const uint64_t* mask, size_t words) {
+  __m128i differ = _mm_setzero_si128();
+  __m128i match = _mm_setzero_si128();
+  size_t w = 0;
+  for (; w + 2 <= words; w += 2) {
+    const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + w));
+    const __m128i x = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + w)),
+                                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + w)));
+    differ = _mm_or_si128(differ, _mm_and_si128(x, m));
+    match = _mm_or_si128(match, _mm_andnot_si128(x, m));
+    if (not _mm_testz_si128(differ, differ) and not _mm_testz_si128(match, match)) {
+      return COLUMNS_DIFFER | COLUMNS_MATCH;
+    }
+  }
+  bool any_differ = not _mm_testz_si128(differ, differ);
+  bool any_match = not _mm_testz_si128(match, match);
+  // At most one word is left over
+  if (w < words) {
+    const uint64_t x = a[w] ^ b[w];
+    any_differ |= (x & mask[w]) != 0;
+    any_match |= (~x & mask[w]) != 0;
+  }
+  return column_bits(any_differ, any_match);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t avx2_count(const uint64_t* column, const uint64_t* mask, size_t words) {
+  // AVX2 has no vector popcount, so unroll to keep several popcnt units busy
+  size_t total0 = 0, total1 = 0, total2 = 0, total3 = 0;
+  size_t w = 0;
+  for (; w + 4 <= words; w += 4) {
+    total0 += _mm_popcnt_u64(column[w] & mask[w]);
+    total1 += _mm_popcnt_u64(column[w + 1] & mask[w + 1]);
+    total2 += _mm_popcnt_u64(column[w + 2] & mask[w + 2]);
+    total3 += _mm_popcnt_u64(column[w + 3] & mask[w + 3]);
+  }
+  for (; w < words; w++) {
+    total0 += _mm_popcnt_u64(column[w] & mask[w]);
+  }
+  return total0 + total1 + total2 + total3;
+}
+
+__attribute__((target("avx2")))
+unsigned avx2_compare(const uint64_t* a, const uint64_t* b, const uint64_t* mask, size_t words) {
+  __m256i differ = _mm256_setzero_si256();
+  __m256i match = _mm256_setzero_si256();
+  size_t w = 0;
+  for (; w + 4 <= words; w += 4) {
+    const __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask + w));
+    const __m256i x = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + w)),
+                                       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + w)));
+    differ = _mm256_or_si256(differ, _mm256_and_si256(x, m));
+    match = _mm256_or_si256(match, _mm256_andnot_si256(x, m));
+    if (not _mm256_testz_si256(differ, differ) and not _mm256_testz_si256(match, match)) {
+      return COLUMNS_DIFFER | COLUMNS_MATCH;
+    }
+  }
+  bool any_differ = not _mm256_testz_si256(differ, differ);
+  bool any_match = not _mm256_testz_si256(match, match);
+  for (; w < words; w++) {
+    const uint64_t x = a[w] ^ b[w];
+    any_differ |= (x & mask[w]) != 0;
+    any_match |= (~x & mask[w]) != 0;
+  }
+  return column_bits(any_differ, any_match);
+}
+
+const ColumnKernel& scalar_kernel() {
+  static const ColumnKernel kernel = {"scalar", scalar_count, scalar_compare};
+  return kernel;
+}
+
+const ColumnKernel* sse4_kernel() {
+  static const ColumnKernel kernel = {"sse4", sse4_count, sse4_compare};
+  if (__builtin_cpu_supports("sse4.1") and __builtin_cpu_supports("popcnt")) {
+    return &kernel;
+  }
+  return nullptr;
+}
+
+const ColumnKernel* avx2_kernel() {
+  static const ColumnKernel kernel = {"avx2", avx2_count, avx2_compare};
+  if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("popcnt")) {
+    return &kernel;
+  }
+  return nullptr;
+}
+
+const ColumnKernel* choose_kernel() {
+  __builtin_cpu_init();
+  const ColumnKernel* best = avx2_kernel();
+  if (best == nullptr) {
+    best = sse4_kernel();
+  }
+  if (best == nullptr) {
+    best = &scalar_kernel();
+  }
+  return best;
+}
+
+const ColumnKernel& best_kernel() {
+  // Initialized exactly once, even when first called from several threads
+  static const ColumnKernel* best = choose_kernel();
+  return *best;
+}
+
+// Finds which columns always have the same value. Returns the number of selected rows.
+size_t find_constants(const ColumnKernel& kernel, const uint64_t* table, size_t columns,
+                      size_t words, const uint64_t* mask, ColumnRelations& result) {
+  const size_t selected = scalar_count(mask, mask, words);
+  result.constant.assign(columns, -1);
+  for (size_t c=0; c < columns; c++) {
+    const size_t ones = kernel.count(table + c * words, mask, words);
+    if (ones == 0) {
+      result.constant[c] = 0;
+    } else if (ones == selected) {
+      result.constant[c] = 1;
+    }
+  }
+  return selected;
+}
+
+ColumnRelations all_pairs_relations(const ColumnKernel& kernel, const uint64_t* table,
+                                    size_t columns, size_t words, const uint64_t* mask) {
+  ColumnRelations result;
+  find_constants(kernel, table, columns, words, mask, result);
+  for (size_t i=0; i < columns; i++) {
+    if (result.constant[i] != -1) {
+      continue;
+    }
+    const uint64_t* column_i = table + i * words;
+    for (size_t j=i+1; j < columns; j++) {
+      if (result.constant[j] != -1) {
+        continue;
+      }
+      const unsigned bits = kernel.compare(column_i, table + j * words, mask, words);
+      if ((bits & COLUMNS_DIFFER) == 0) {
+        result.relations.push_back({i, j, false});
+      } else if ((bits & COLUMNS_MATCH) == 0) {
+        result.relations.push_back({i, j, true});
+      }
+    }
+  }
+  return result;
+}
+
+ColumnRelations hashed_relations(const ColumnKernel& kernel, const uint64_t* table,
+                                 size_t columns, size_t words, const uint64_t* mask) {
+  ColumnRelations result;
+  const size_t selected = find_constants(kernel, table, columns, words, mask, result);
+  if (selected == 0) {
+    return result;
+  }
+  // Columns are hashed after flipping them so the first selected row is 0,
+  // which gives a column and its inverse the same hash
+  size_t first_word = 0;
+  while (mask[first_word] == 0) {
+    first_word++;
+  }
+  const uint64_t first_bit = mask[first_word] & (~mask[first_word] + 1);
+  // Maps hashes to the columns (and if they were flipped) that first had that hash
+  unordered_map<uint64_t, vector<std::pair<size_t, bool>>> representatives;
+  for (size_t c=0; c < columns; c++) {
+    if (result.constant[c] != -1) {
+      continue;
+    }
+    const uint64_t* column_c = table + c * words;
+    const bool flipped = (column_c[first_word] & first_bit) != 0;
+    const uint64_t flip = flipped ? ~uint64_t(0) : 0;
+    uint64_t hash = words;
+    for (size_t w=0; w < words; w++) {
+      hash = (hash ^ ((column_c[w] ^ flip) & mask[w])) * 0x100000001b3ULL;
+      hash ^= hash >> 29;
+    }
+    auto& bucket = representatives[hash];
+    bool found = false;
+    for (const auto& candidate : bucket) {
+      // Verify the hash match, as collisions are possible
+      const unsigned bits = kernel.compare(table + candidate.first * words, column_c, mask, words);
+      const bool negated = candidate.second != flipped;
+      if ((bits & (negated ? COLUMNS_MATCH : COLUMNS_DIFFER)) == 0) {
+        result.relations.push_back({candidate.first, c, negated});
+        found = true;
+        break;
+      }
+    }
+    if (not found) {
+      bucket.emplace_back(c, flipped);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,56 @@
+// Routines for comparing the packed bit columns used by DNF tables.
+// Each routine has a scalar version and SIMD versions (SSE4.1, AVX2),
+// with the best one the current CPU supports chosen at runtime.
+#ifndef COLUMNKERNEL_H_
+#define COLUMNKERNEL_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+using std::size_t;
+
+// Bits returned by "compare", describing the rows selected by "mask"
+// Some selected row has different values in the two columns
+const unsigned COLUMNS_DIFFER = 1;
+// Some selected row has the same value in both columns
+const unsigned COLUMNS_MATCH = 2;
+
+struct ColumnKernel {
+  const char* name;
+  // Number of rows selected by "mask" which are set in "column"
+  size_t (*count)(const uint64_t* column, const uint64_t* mask, size_t words);
+  // Combination of COLUMNS_DIFFER and COLUMNS_MATCH, stops as soon as both are found
+  unsigned (*compare)(const uint64_t* a, const uint64_t* b, const uint64_t* mask, size_t words);
+};
+
+const ColumnKernel& scalar_kernel();
+// Returns null if the CPU does not support that instruction set
+const ColumnKernel* sse4_kernel();
+const ColumnKernel* avx2_kernel();
+// The fastest kernel this CPU supports
+const ColumnKernel& best_kernel();
+
+// A pair of columns (first < second) which are always equal or always opposite
+struct ColumnRelation {
+  size_t first, second;
+  bool negated;
+};
+
+// What a table's columns reveal, restricted to the rows selected by "mask"
+struct ColumnRelations {
+  // For each column: -1 if it varies, otherwise the value it always has
+  std::vector<signed char> constant;
+  // Relations between columns that are not constant
+  std::vector<ColumnRelation> relations;
+};
+
+// Compares every pair of non-constant columns. Each member of a group of
+// equivalent columns is related to every other member.
+ColumnRelations all_pairs_relations(const ColumnKernel& kernel, const uint64_t* table,
+                                    size_t columns, size_t words, const uint64_t* mask);
+// Hashes each column (and its inverse) to find candidates, then verifies them.
+// Each member of a group of equivalent columns is related to the first member only.
+ColumnRelations hashed_relations(const ColumnKernel& kernel, const uint64_t* table,
+                                 size_t columns, size_t words, const uint64_t* mask);
+
+#endif /* COLUMNKERNEL_H_ */
@@ -6,13 +6,241 @@
  */
 
 #include "DNF.h"
+#include "Checkpoint.h"
+#include "ColumnKernel.h"
+#include "MemoryUsage.h"
+#include "ThreadPool.h"
 using std::endl;
 #include <algorithm>
 using std::find;
+#include <map>
+#include <numeric>
 #include <unordered_map>
 using std::unordered_map;
 
+size_t DNF::parallel_merge_rows = 1 << 14;
+size_t DNF::lazy_merge_rows = 1 << 16;
+// Words of each column handled by a single task during a parallel merge
+const size_t MERGE_CHUNK_WORDS = 256;
+// A parallel merge indexes "a" as 2^MERGE_PARTITION_BITS partitions
+const size_t MERGE_PARTITION_BITS = 6;
+// Inputs with more rows than this are sampled by "estimate_merge_rows"
+const size_t ESTIMATE_SAMPLE_ROWS = 1024;
+
+// Runs "body" for each index on the global pool, or serially if not "parallel"
+void for_each_index(bool parallel, size_t count, const std::function<void(size_t)>& body) {
+  if (parallel) {
+    ThreadPool::global().parallel_for(count, body);
+    return;
+  }
+  for (size_t i=0; i < count; i++) {
+    body(i);
+  }
+}
+
+// Number of uint64_t needed to store one bit per row
+size_t words_for(size_t rows) {
+  return (rows + 63) >> 6;
+}
+
+// Pseudorandom weight given to row "r" when signatures are computed (splitmix64)
+uint64_t row_weight(size_t r) {
+  uint64_t z = r + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+DNF::DNF(const vector<size_t>& var, const vector<vector<bool>>& tab) : variables(var) {
+  allocate(tab.size());
+  for (size_t r=0; r < tab.size(); r++) {
+    assert(tab[r].size() == variables.size());
+    for (size_t c=0; c < variables.size(); c++) {
+      if (tab[r][c]) {
+        set(r, c);
+      }
+    }
+  }
+  shrink_if_small();
+  if (not small) {
+    compute_signatures();
+  }
+}
+
+DNF::DNF(const vector<size_t>& var, uint64_t truth) : variables(var), small(true) {
+  assert(variables.size() <= SMALL_LIMIT);
+  truth_table = truth & small_ops(variables.size()).full();
+  rows = __builtin_popcountll(truth_table);
+}
+
+DNF::DNF(const vector<size_t>& var, const vector<uint64_t>& truth) : variables(var) {
+  if (variables.size() <= SMALL_LIMIT) {
+    small = true;
+    truth_table = (truth.empty() ? 0 : truth[0]) & small_ops(variables.size()).full();
+    rows = __builtin_popcountll(truth_table);
+    return;
+  }
+  assert(variables.size() < 64);
+  assert(truth.size() <= (uint64_t(1) << variables.size()) / 64);
+  size_t total = 0;
+  for (const auto word : truth) {
+    total += __builtin_popcountll(word);
+  }
+  allocate(total);
+  // Each set bit becomes a row, in increasing order of position
+  size_t r = 0;
+  for (size_t w=0; w < truth.size(); w++) {
+    for (uint64_t remaining = truth[w]; remaining; remaining &= remaining - 1) {
+      const size_t position = w * 64 + __builtin_ctzll(remaining);
+      for (size_t c=0; c < variables.size(); c++) {
+        if ((position >> c) & 1) {
+          set(r, c);
+        }
+      }
+      r++;
+    }
+  }
+  compute_signatures();
+}
+
+size_t DNF::small_position(size_t row) const {
+  assert(small and row < rows);
+  uint64_t remaining = truth_table;
+  for (; row > 0; row--) {
+    remaining &= remaining - 1;
+  }
+  return __builtin_ctzll(remaining);
+}
+
+void DNF::shrink_if_small() {
+  if (small or variables.size() > SMALL_LIMIT) {
+    return;
+  }
+  truth_table = 0;
+  for (size_t r=0; r < rows; r++) {
+    size_t position = 0;
+    for (size_t c=0; c < variables.size(); c++) {
+      position |= size_t(get(r, c)) << c;
+    }
+    truth_table |= uint64_t(1) << position;
+  }
+  small = true;
+  // Any duplicate rows collapse into a single position
+  rows = __builtin_popcountll(truth_table);
+  words = 0;
+  table.clear();
+  table.shrink_to_fit();
+  clear_signatures();
+}
+
+void DNF::compute_signatures(bool parallel) {
+  row_weights.resize(rows);
+  weight_total = 0;
+  for (size_t r=0; r < rows; r++) {
+    row_weights[r] = row_weight(r);
+    weight_total += row_weights[r];
+  }
+  ones.assign(variables.size(), 0);
+  fingerprints.assign(variables.size(), 0);
+  for_each_index(parallel, variables.size(), [&](size_t c) {
+    const uint64_t* column_c = column(c);
+    size_t count = 0;
+    uint64_t sum = 0;
+    for (size_t w=0; w < words; w++) {
+      count += __builtin_popcountll(column_c[w]);
+      for (uint64_t bits = column_c[w]; bits; bits &= bits - 1) {
+        sum += row_weights[(w << 6) + __builtin_ctzll(bits)];
+      }
+    }
+    ones[c] = count;
+    fingerprints[c] = sum;
+  });
+}
+
+void DNF::clear_signatures() {
+  ones.clear();
+  ones.shrink_to_fit();
+  fingerprints.clear();
+  fingerprints.shrink_to_fit();
+  row_weights.clear();
+  row_weights.shrink_to_fit();
+  weight_total = 0;
+}
+
+void DNF::save(CheckpointWriter& out) const {
+  if (join) {
+    DNF materialized(*this);
+    materialized.materialize();
+    materialized.save(out);
+    return;
+  }
+  out.write_vector(variables);
+  out.write(small);
+  out.write(truth_table);
+  out.write(rows);
+  out.write(words);
+  out.write_vector(table);
+}
+
+void DNF::restore(CheckpointReader& in) {
+  in.read_vector(variables);
+  small = in.read();
+  truth_table = in.read();
+  rows = in.read();
+  words = in.read();
+  in.read_vector(table);
+  if (table.size() != (small ? 0 : variables.size() * words) or (not small and words != words_for(rows))) {
+    in.error("function table does not match its size");
+  }
+  hash_known = false;
+  version++;
+  if (small) {
+    clear_signatures();
+  } else {
+    compute_signatures();
+  }
+}
+
+DNF DNF::expanded() const {
+  if (not small) {
+    return *this;
+  }
+  DNF result;
+  result.variables = variables;
+  result.allocate(rows);
+  size_t r = 0;
+  for (uint64_t remaining = truth_table; remaining; remaining &= remaining - 1, r++) {
+    const size_t position = __builtin_ctzll(remaining);
+    for (size_t c=0; c < variables.size(); c++) {
+      if ((position >> c) & 1) {
+        result.set(r, c);
+      }
+    }
+  }
+  result.compute_signatures();
+  return result;
+}
+
+void DNF::allocate(size_t total_rows) {
+  rows = total_rows;
+  words = words_for(rows);
+  table.assign(variables.size() * words, 0);
+}
+
+uint64_t DNF::tail_mask() const {
+  if ((rows & 63) == 0) {
+    return ~uint64_t(0);
+  }
+  return (uint64_t(1) << (rows & 63)) - 1;
+}
+
 void DNF::print(std::ostream& out) const {
+  if (join) {
+    DNF materialized(*this);
+    materialized.materialize();
+    materialized.print(out);
+    return;
+  }
   if (variables.size() == 0) {
     out << "(Empty DNF)" << endl;
     return;
@@ -21,225 +249,1226 @@ void DNF::print(std::ostream& out) const {
     out << var << " ";
   }
   out << endl;
-  for (const auto& row : table) {
-    for (const auto bit : row) {
-      out << bit << " ";
+  for (size_t r=0; r < rows; r++) {
+    for (size_t c=0; c < variables.size(); c++) {
+      out << get(r, c) << " ";
     }
     out << endl;
   }
   out << endl;
 }
 
-Knowledge DNF::create_knowledge() const {
+vector<uint64_t> DNF::row_mask() const {
+  vector<uint64_t> mask(words, ~uint64_t(0));
+  if (words > 0) {
+    mask.back() = tail_mask();
+  }
+  return mask;
+}
+
+// Converts what the column kernel found into knowledge about the variables
+Knowledge relations_to_knowledge(const vector<size_t>& variables, const ColumnRelations& found) {
   Knowledge knowledge;
-  if (table.size() == 0) {
+  for (size_t i=0; i < variables.size(); i++) {
+    if (found.constant[i] != -1) {
+      knowledge.add(variables[i], found.constant[i] == 1);
+    }
+  }
+  for (const auto& relation : found.relations) {
+    knowledge.add(TwoConsistency(variables[relation.first], variables[relation.second], relation.negated));
+  }
+  return knowledge;
+}
+
+Knowledge DNF::create_knowledge() const {
+  if (rows == 0) {
+    Knowledge knowledge;
     knowledge.is_unsat = true;
     return knowledge;
   }
-  assert(variables.size() > 0 or table.size() == 1);
-
-  size_t total_variables = variables.size();
-  for (size_t i=0; i < total_variables; i++) {
-    // The bool in this pair is if the relationship is "negated"
-    vector<std::pair<size_t, bool>> consistent;
-    // Record the relationships between variables in the first row
-    for (size_t j=i+1; j < total_variables; j++) {
-      consistent.emplace_back(j, table[0][i] != table[0][j]);
-    }
-    // Check if that relationship is maintained across all rows
-    size_t sum_of_i = 0;
-    for (const auto& row : table) {
-      auto value_of_i = row[i];
-      sum_of_i += value_of_i;
-      for (size_t j=0; j < consistent.size(); j++) {
-        auto negated = value_of_i != row[consistent[j].first];
-        if (negated != consistent[j].second) {
-          // the pattern is broken, so remove it from "consistent"
-          swap(consistent[j], consistent.back());
-          consistent.pop_back();
-          j--;
+  assert(variables.size() > 0 or rows == 1);
+  if (join) {
+    return join_knowledge();
+  }
+  if (not small) {
+    return relations_to_knowledge(variables, signature_relations());
+  }
+  vector<uint64_t> mask(mask_words());
+  fill_mask(mask.data());
+  return create_knowledge(mask.data());
+}
+
+ColumnRelations DNF::signature_relations() const {
+  assert(not small and not join and ones.size() == variables.size());
+  ColumnRelations found;
+  found.constant.assign(variables.size(), -1);
+  // A column and its inverse are given the smaller of their two fingerprints
+  vector<std::pair<uint64_t, size_t>> candidates;
+  for (size_t c=0; c < variables.size(); c++) {
+    if (ones[c] == 0 or ones[c] == rows) {
+      found.constant[c] = ones[c] != 0;
+      continue;
+    }
+    candidates.emplace_back(std::min(fingerprints[c], weight_total - fingerprints[c]), c);
+  }
+  std::sort(candidates.begin(), candidates.end());
+  const auto& kernel = best_kernel();
+  const auto mask = row_mask();
+  vector<size_t> representatives;
+  for (size_t begin=0, end; begin < candidates.size(); begin = end) {
+    for (end = begin + 1; end < candidates.size() and candidates[end].first == candidates[begin].first; end++) {
+    }
+    // Each column is related to the first in its group that it matches.
+    // Only a fingerprint collision makes a column start a new representative.
+    representatives.clear();
+    for (size_t i=begin; i < end; i++) {
+      const size_t c = candidates[i].second;
+      bool related = false;
+      for (const auto r : representatives) {
+        const unsigned result = kernel.compare(column(r), column(c), mask.data(), words);
+        if (result == COLUMNS_MATCH or result == COLUMNS_DIFFER) {
+          found.relations.push_back({r, c, result == COLUMNS_DIFFER});
+          related = true;
+          break;
         }
       }
+      if (not related) {
+        representatives.push_back(c);
+      }
     }
-    if (sum_of_i == 0) {
-      // If "i" was always 0, assign it
-      knowledge.add(variables[i], false);
-    } else if (sum_of_i == table.size()) {
-      // If "i" was always 1, assign it
-      knowledge.add(variables[i], true);
-    } else {
-      // Anything still consistent here is actually consistent
-      for (const auto& pair : consistent) {
-        knowledge.add(TwoConsistency(variables[i], variables[pair.first], pair.second));
+  }
+  // Report relations in column order, as "all_pairs_relations" does
+  std::sort(found.relations.begin(), found.relations.end(), [](const ColumnRelation& x, const ColumnRelation& y) {
+    return x.first < y.first or (x.first == y.first and x.second < y.second);
+  });
+  return found;
+}
+
+struct DNF::Join {
+  DNF a, b;
+  // Columns holding the same variable in "a" and "b"
+  vector<size_t> shared_col_a, shared_col_b;
+  // Columns of "b" whose variables are not in "a", in the order they follow a's variables
+  vector<size_t> b_only_col;
+};
+
+size_t DNF::mask_words() const {
+  if (join) {
+    return join->a.mask_words() + join->b.mask_words();
+  }
+  return small ? 1 : words;
+}
+
+void DNF::fill_mask(uint64_t* mask) const {
+  if (join) {
+    join->a.fill_mask(mask);
+    join->b.fill_mask(mask + join->a.mask_words());
+    return;
+  }
+  if (small) {
+    // Positions outside the truth table are never rows, so they need no masking
+    mask[0] = ~uint64_t(0);
+    return;
+  }
+  for (size_t w=0; w < words; w++) {
+    mask[w] = ~uint64_t(0);
+  }
+  if (words > 0) {
+    mask[words - 1] = tail_mask();
+  }
+}
+
+void DNF::restrict(const Knowledge& knowledge, uint64_t* mask) const {
+  if (join) {
+    join->a.restrict(knowledge, mask);
+    join->b.restrict(knowledge, mask + join->a.mask_words());
+    return;
+  }
+  // The variable each column is rewritten to (0 if assigned), and if it is negated
+  vector<size_t> target(variables.size());
+  vector<bool> negated(variables.size());
+  for (size_t i=0; i < variables.size(); i++) {
+    const size_t v = variables[i];
+    if (knowledge.is_assigned(v)) {
+      const bool value = knowledge.value(v);
+      if (small) {
+        mask[0] &= value ? small_variable_mask(i) : ~small_variable_mask(i);
+      } else {
+        const uint64_t* column_i = column(i);
+        for (size_t w=0; w < words; w++) {
+          mask[w] &= value ? column_i[w] : ~column_i[w];
+        }
       }
+      continue;
+    }
+    target[i] = v;
+    if (knowledge.is_rewritten(v)) {
+      const auto rewrite = knowledge.rewrite(v);
+      target[i] = rewrite.to;
+      negated[i] = rewrite.negated;
+    }
+    // Only keep rows where this column agrees with an earlier column of the same class
+    for (size_t j=0; j < i; j++) {
+      if (target[j] != target[i]) {
+        continue;
+      }
+      const bool opposite = negated[i] != negated[j];
+      if (small) {
+        const uint64_t differ = small_variable_mask(i) ^ small_variable_mask(j);
+        mask[0] &= opposite ? differ : ~differ;
+      } else {
+        const uint64_t* column_i = column(i);
+        const uint64_t* column_j = column(j);
+        for (size_t w=0; w < words; w++) {
+          const uint64_t differ = column_i[w] ^ column_j[w];
+          mask[w] &= opposite ? differ : ~differ;
+        }
+      }
+      break;
     }
   }
-  return knowledge;
 }
 
+Knowledge DNF::create_knowledge(const uint64_t* mask) const {
+  if (join) {
+    // Every merged row is made of kept rows of both inputs, so what holds for
+    // all kept rows of either holds for all kept merged rows
+    auto knowledge = join->a.create_knowledge(mask);
+    if (not knowledge.is_unsat) {
+      knowledge.add(join->b.create_knowledge(mask + join->a.mask_words()));
+    }
+    return knowledge;
+  }
+  const auto& kernel = best_kernel();
+  if (small) {
+    const uint64_t kept = truth_table & mask[0];
+    if (kept == 0) {
+      Knowledge knowledge;
+      knowledge.is_unsat = true;
+      return knowledge;
+    }
+    return relations_to_knowledge(variables, small_ops(variables.size()).relations(kept));
+  }
+  if (kernel.count(mask, mask, words) == 0) {
+    Knowledge knowledge;
+    knowledge.is_unsat = true;
+    return knowledge;
+  }
+  auto found = all_pairs_relations(kernel, table.data(), variables.size(), words, mask);
+  return relations_to_knowledge(variables, found);
+}
 
 Knowledge DNF::create_knowledge_alternate() const {
-  Knowledge knowledge;
-  if (table.size() == 0) {
+  assert(not join);
+  if (rows == 0) {
+    Knowledge knowledge;
     knowledge.is_unsat = true;
     return knowledge;
   }
-  assert(variables.size() > 0 or table.size() == 1);
-  // Create a set of unique patterns to variables
-  unordered_map<vector<bool>, std::pair<size_t, bool>> unique;
-  const size_t total_variables = variables.size();
-  const size_t total_rows = table.size();
-  for (size_t i=0; i < total_variables; i++) {
-    // The row and its inverse
-    vector<bool> key(total_rows);
-    vector<bool> neg_key(total_rows);
-    size_t sum=0;
-    for (size_t r=0; r < total_rows; r++) {
-      const auto bit = table[r][i];
-      key[r] = bit;
-      neg_key[r] = not bit;
-      sum += bit;
-    }
-    if (sum == 0) {
-      knowledge.add(variables[i], false);
-    } else if (sum == total_rows) {
-      knowledge.add(variables[i], true);
-    } else {
-      auto inserted = unique.insert({key, {variables[i], false}});
-      if (inserted.second) {
-        // It was unique, so insert the inverse
-        unique.insert({neg_key, {variables[i], true}});
+  assert(variables.size() > 0 or rows == 1);
+  if (small) {
+    return relations_to_knowledge(variables, small_ops(variables.size()).relations(truth_table));
+  }
+  const auto mask = row_mask();
+  auto found = hashed_relations(best_kernel(), table.data(), variables.size(), words, mask.data());
+  return relations_to_knowledge(variables, found);
+}
+
+bool DNF::apply_knowledge_small(const Knowledge& knowledge) {
+  bool change_made = false;
+  for (size_t i=0; i < variables.size(); i++) {
+    const auto& ops = small_ops(variables.size());
+    if (knowledge.is_assigned(variables[i])) {
+      change_made = true;
+      // Cofactor, which moves the last variable into column "i"
+      truth_table = ops.remove(truth_table, i, knowledge.value(variables[i]));
+      std::swap(variables[i], variables.back());
+      variables.pop_back();
+      i--;
+      continue;
+    }
+    if (knowledge.is_rewritten(variables[i])) {
+      change_made = true;
+      const auto rewrite = knowledge.rewrite(variables[i]);
+      auto to_it = find(variables.begin(), variables.end(), rewrite.to);
+      if (to_it != variables.end()) {
+        // Keep rows that satisfy the two consistency, then "i" is redundant
+        truth_table = ops.filter(truth_table, i, to_it - variables.begin(), rewrite.negated);
+        truth_table = ops.project(truth_table, i);
+        std::swap(variables[i], variables.back());
+        variables.pop_back();
+        i--;
       } else {
-        // Only get here because something is already in inserted
-        auto pair = inserted.first->second;
-        knowledge.add(TwoConsistency(variables[i], pair.first, pair.second));
+        assert(variables[i] != rewrite.to);
+        variables[i] = rewrite.to;
+        if (rewrite.negated) {
+          truth_table = small_negate_variable(truth_table, i);
+        }
       }
     }
   }
-  return knowledge;
+  rows = __builtin_popcountll(truth_table);
+  return change_made;
 }
 
-
-
 bool DNF::apply_knowledge(const Knowledge& knowledge) {
+  bool change_made;
+  if (small) {
+    change_made = apply_knowledge_small(knowledge);
+  } else if (join) {
+    change_made = apply_knowledge_join(knowledge);
+  } else {
+    change_made = apply_knowledge_table(knowledge);
+  }
+  hash_known = hash_known and not change_made;
+  if (change_made) {
+    version++;
+  }
+  return change_made;
+}
+
+bool DNF::apply_knowledge_table(const Knowledge& knowledge) {
   bool change_made = false;
+  vector<uint64_t> keep(words);
   for (size_t i=0; i < variables.size(); i++) {
     // First check if variable[i] is assigned by this knowledge
-    auto assigned_it = knowledge.assigned.find(variables[i]);
-    if (assigned_it != knowledge.assigned.end()) {
+    if (knowledge.is_assigned(variables[i])) {
       change_made = true;
-      // Filter
-      for (size_t r=0; r < table.size(); r++) {
-        if (table[r][i] != assigned_it->second) {
-          swap(table[r], table.back());
-          table.pop_back();
-          r--;
-        }
+      const bool value = knowledge.value(variables[i]);
+      // Filter, a word at a time
+      const uint64_t* column_i = column(i);
+      for (size_t w=0; w < words; w++) {
+        keep[w] = value ? column_i[w] : ~column_i[w];
       }
+      filter_rows(keep);
       remove_column(i);
       i--;
       // I use a continue here to prevent over-nesting
       continue;
     }
     // Check if variable[i] gets rewritten using this knowledge
-    auto rewrite_it = knowledge.rewrites.find(variables[i]);
-    if (rewrite_it != knowledge.rewrites.end()) {
+    if (knowledge.is_rewritten(variables[i])) {
       change_made = true;
+      const auto rewrite = knowledge.rewrite(variables[i]);
       // Check if variable[i] rewrites to a variable already in this DNF
-      auto to_it = find(variables.begin(), variables.end(), rewrite_it->second.to);
+      auto to_it = find(variables.begin(), variables.end(), rewrite.to);
       if (to_it != variables.end()) {
         // This table includes both parts of a two consistency, so we need to filter
         size_t to_index = to_it - variables.begin();
-        for (size_t r=0; r < table.size(); r++) {
-          auto negated = table[r][i] != table[r][to_index];
-          if (negated != rewrite_it->second.negated) {
-            swap(table[r], table.back());
-            table.pop_back();
-            r--;
-          }
+        const uint64_t* column_i = column(i);
+        const uint64_t* column_to = column(to_index);
+        for (size_t w=0; w < words; w++) {
+          auto negated = column_i[w] ^ column_to[w];
+          keep[w] = rewrite.negated ? negated : ~negated;
         }
+        filter_rows(keep);
         remove_column(i);
         i--;
       }
       else {
-        assert(variables[i] != rewrite_it->second.to);
+        assert(variables[i] != rewrite.to);
         // it only contains the "from" so no rows are removed
-        variables[i] = rewrite_it->second.to;
+        variables[i] = rewrite.to;
         // If the relationship was negated, invert the column
-        if (rewrite_it->second.negated) {
-          for (auto& row : table) {
-            row[i] = not row[i];
+        if (rewrite.negated and words > 0) {
+          uint64_t* column_i = column(i);
+          for (size_t w=0; w < words; w++) {
+            column_i[w] = ~column_i[w];
           }
+          column_i[words - 1] &= tail_mask();
+          ones[i] = rows - ones[i];
+          fingerprints[i] = weight_total - fingerprints[i];
         }
       }
     }
+    // Filtering may have shrunk the table
+    keep.resize(words);
   }
+  shrink_if_small();
   return change_made;
 }
 
+void DNF::filter_rows(const vector<uint64_t>& keep) {
+  assert(keep.size() >= words);
+  if (words == 0) {
+    return;
+  }
+  const uint64_t last_mask = tail_mask();
+  size_t new_rows = 0;
+  for (size_t w=0; w + 1 < words; w++) {
+    new_rows += __builtin_popcountll(keep[w]);
+  }
+  new_rows += __builtin_popcountll(keep[words - 1] & last_mask);
+  if (new_rows == rows) {
+    // Nothing was removed
+    return;
+  }
+  const size_t new_words = words_for(new_rows);
+  vector<uint64_t> filtered(variables.size() * new_words, 0);
+  for (size_t c=0; c < variables.size(); c++) {
+    const uint64_t* from = column(c);
+    uint64_t* to = filtered.data() + c * new_words;
+    size_t position = 0;
+    for (size_t w=0; w < words; w++) {
+      uint64_t mask = keep[w];
+      if (w + 1 == words) {
+        mask &= last_mask;
+      }
+      // Take the removed rows out of this column's signature
+      const uint64_t removed = from[w] & ~mask;
+      if (removed) {
+        ones[c] -= __builtin_popcountll(removed);
+        for (uint64_t bits = removed; bits; bits &= bits - 1) {
+          fingerprints[c] -= row_weights[(w << 6) + __builtin_ctzll(bits)];
+        }
+      }
+      if (mask == ~uint64_t(0)) {
+        // The whole word is kept, so just shift it into place
+        to[position >> 6] |= from[w] << (position & 63);
+        if (position & 63) {
+          to[(position >> 6) + 1] |= from[w] >> (64 - (position & 63));
+        }
+        position += 64;
+        continue;
+      }
+      // Copy over each kept bit
+      for (; mask; mask &= mask - 1) {
+        const auto bit = __builtin_ctzll(mask);
+        to[position >> 6] |= ((from[w] >> bit) & 1) << (position & 63);
+        position++;
+      }
+    }
+    assert(position == new_rows);
+  }
+  // Kept rows keep their weights, so no fingerprint needs to be recomputed
+  size_t position = 0;
+  for (size_t w=0; w < words; w++) {
+    const uint64_t mask = w + 1 == words ? keep[w] & last_mask : keep[w];
+    for (size_t bit=0; bit < 64 and (w << 6) + bit < rows; bit++) {
+      const uint64_t weight = row_weights[(w << 6) + bit];
+      if ((mask >> bit) & 1) {
+        row_weights[position++] = weight;
+      } else {
+        weight_total -= weight;
+      }
+    }
+  }
+  row_weights.resize(position);
+  table.swap(filtered);
+  rows = new_rows;
+  words = new_words;
+  version++;
+}
+
 void DNF::remove_column(size_t col) {
   assert(col < variables.size());
   // Remove the column header
   std::swap(variables[col], variables.back());
   variables.pop_back();
-  // Swap each column to the end and delete it
-  for (auto & row : table) {
-    swap(row[col], row.back());
-    row.pop_back();
+  std::swap(ones[col], ones.back());
+  ones.pop_back();
+  std::swap(fingerprints[col], fingerprints.back());
+  fingerprints.pop_back();
+  // Swap the column to the end and delete it
+  std::swap_ranges(column(col), column(col) + words, column(variables.size()));
+  table.resize(variables.size() * words);
+}
+
+vector<uint64_t> DNF::pack_keys(const vector<size_t>& key_columns, size_t key_words, bool parallel) const {
+  vector<uint64_t> keys(rows * key_words, 0);
+  // Chunks of whole words never share a row, so each chunk can be packed separately
+  const size_t chunk_words = parallel ? MERGE_CHUNK_WORDS : std::max<size_t>(words, 1);
+  const size_t chunks = (words + chunk_words - 1) / chunk_words;
+  for_each_index(parallel, chunks, [&](size_t chunk) {
+    const size_t end = std::min(words, (chunk + 1) * chunk_words);
+    for (size_t k=0; k < key_columns.size(); k++) {
+      const uint64_t* key_column = column(key_columns[k]);
+      const size_t offset = k >> 6;
+      const uint64_t bit = uint64_t(1) << (k & 63);
+      // Only rows with a 1 in this column need updating
+      for (size_t w=chunk * chunk_words; w < end; w++) {
+        for (uint64_t ones = key_column[w]; ones; ones &= ones - 1) {
+          const size_t r = (w << 6) + __builtin_ctzll(ones);
+          keys[r * key_words + offset] |= bit;
+        }
+      }
+    }
+  });
+  return keys;
+}
+
+void DNF::set_range(size_t col, size_t begin, size_t end) {
+  uint64_t* to = column(col);
+  while (begin < end) {
+    const size_t offset = begin & 63;
+    const size_t length = std::min<size_t>(64 - offset, end - begin);
+    const uint64_t bits = length == 64 ? ~uint64_t(0) : (uint64_t(1) << length) - 1;
+    to[begin >> 6] |= bits << offset;
+    begin += length;
   }
 }
 
-// This function is used by "merge" but isn't needed outside of this file
-vector<bool> extract_key(const vector<size_t>& variables_in_key, const unordered_map<size_t, size_t>& var_to_col, const vector<bool>& row) {
-  vector<bool> key;
-  for (const auto v : variables_in_key) {
-    key.push_back(row[var_to_col.at(v)]);
+// Hashes a key of "key_words" words, as created by "pack_keys"
+uint64_t hash_key(const uint64_t* key, size_t key_words) {
+  uint64_t hash = 0x9e3779b97f4a7c15ULL;
+  for (size_t w=0; w < key_words; w++) {
+    hash ^= key[w];
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 31;
   }
-  return key;
+  return hash;
+}
+
+// Open addressing hash table that numbers each distinct key it is given.
+// Keys are not copied, so they must outlive the table. Callers supply
+// each key's "hash_key" so it is only computed once.
+class KeyIndex {
+ public:
+  static const size_t NO_BUCKET = size_t(-1);
+  KeyIndex(size_t words_per_key, size_t expected) : key_words(words_per_key) {
+    size_t capacity = 16;
+    while (capacity < 2 * expected) {
+      capacity <<= 1;
+    }
+    slots.assign(capacity, NO_BUCKET);
+  }
+  // Returns the bucket for "key", creating a new bucket if this key is new
+  size_t insert(const uint64_t* key, uint64_t hash) {
+    size_t slot = hash & (slots.size() - 1);
+    while (slots[slot] != NO_BUCKET) {
+      if (same(key, slots[slot])) {
+        return slots[slot];
+      }
+      slot = (slot + 1) & (slots.size() - 1);
+    }
+    slots[slot] = representatives.size();
+    representatives.push_back(key);
+    return slots[slot];
+  }
+  size_t find(const uint64_t* key, uint64_t hash) const {
+    size_t slot = hash & (slots.size() - 1);
+    while (slots[slot] != NO_BUCKET) {
+      if (same(key, slots[slot])) {
+        return slots[slot];
+      }
+      slot = (slot + 1) & (slots.size() - 1);
+    }
+    return NO_BUCKET;
+  }
+  size_t size() const {
+    return representatives.size();
+  }
+ private:
+  size_t key_words;
+  vector<size_t> slots;
+  // The first key added to each bucket
+  vector<const uint64_t*> representatives;
+  bool same(const uint64_t* key, size_t bucket) const {
+    return std::equal(key, key + key_words, representatives[bucket]);
+  }
+};
+const size_t KeyIndex::NO_BUCKET;
+
+void DNF::fill_merged_column(size_t c, const DNF& a, const DNF& b, const vector<size_t>& b_only_col,
+                             const vector<size_t>& bucket_of_b, const vector<size_t>& bucket_start,
+                             const vector<size_t>& a_rows) {
+  size_t out = 0;
+  if (c < a.variables.size()) {
+    for (const auto bucket : bucket_of_b) {
+      if (bucket == KeyIndex::NO_BUCKET) {
+        continue;
+      }
+      for (size_t i=bucket_start[bucket]; i < bucket_start[bucket + 1]; i++, out++) {
+        if (a.get(a_rows[i], c)) {
+          set(out, c);
+        }
+      }
+    }
+    return;
+  }
+  // Variables only in "b" are constant across each row's block of output
+  const size_t b_col = b_only_col[c - a.variables.size()];
+  for (size_t r=0; r < b.rows; r++) {
+    const auto bucket = bucket_of_b[r];
+    if (bucket == KeyIndex::NO_BUCKET) {
+      continue;
+    }
+    const size_t matches = bucket_start[bucket + 1] - bucket_start[bucket];
+    if (b.get(r, b_col)) {
+      set_range(c, out, out + matches);
+    }
+    out += matches;
+  }
+}
+
+DNF DNF::merge_small(const DNF& a, const DNF& b) {
+  DNF result;
+  result.small = true;
+  result.variables = a.variables;
+  // Where each of b's variables ends up in the result
+  vector<size_t> position_in_result;
+  for (const auto v : b.variables) {
+    auto it = find(a.variables.begin(), a.variables.end(), v);
+    if (it == a.variables.end()) {
+      position_in_result.push_back(result.variables.size());
+      result.variables.push_back(v);
+    } else {
+      position_in_result.push_back(it - a.variables.begin());
+    }
+  }
+  const size_t total = result.variables.size();
+  assert(total <= SMALL_LIMIT);
+  // Extend both tables with free variables until they cover the result
+  uint64_t table_a = a.truth_table;
+  for (size_t n=a.variables.size(); n < total; n++) {
+    table_a = small_ops(n).extend(table_a);
+  }
+  uint64_t table_b = b.truth_table;
+  for (size_t n=b.variables.size(); n < total; n++) {
+    table_b = small_ops(n).extend(table_b);
+  }
+  // The free variables in "b" cover whatever positions its own variables don't
+  vector<bool> used(total, false);
+  for (const auto p : position_in_result) {
+    used[p] = true;
+  }
+  for (size_t p=0; p < total; p++) {
+    if (not used[p]) {
+      position_in_result.push_back(p);
+    }
+  }
+  // Swap b's variables into place
+  for (size_t target=0; target < total; target++) {
+    size_t current = find(position_in_result.begin(), position_in_result.end(), target) - position_in_result.begin();
+    if (current != target) {
+      table_b = small_swap_variables(table_b, current, target);
+      std::swap(position_in_result[current], position_in_result[target]);
+    }
+  }
+  result.truth_table = table_a & table_b;
+  result.rows = __builtin_popcountll(result.truth_table);
+  return result;
+}
+
+size_t DNF::column_ones(size_t col) const {
+  if (small) {
+    return __builtin_popcountll(truth_table & small_variable_mask(col));
+  }
+  return ones[col];
+}
+
+// Hashes of the shared variables of up to "ESTIMATE_SAMPLE_ROWS" evenly spaced
+// rows of "dnf", sorted so equal keys are together
+vector<uint64_t> sample_key_hashes(const DNF& dnf, const vector<size_t>& key_columns) {
+  const size_t samples = std::min(dnf.total_rows(), ESTIMATE_SAMPLE_ROWS);
+  const size_t key_words = (key_columns.size() + 63) >> 6;
+  vector<uint64_t> hashes(samples), key(key_words);
+  for (size_t i=0; i < samples; i++) {
+    const size_t r = i * dnf.total_rows() / samples;
+    std::fill(key.begin(), key.end(), 0);
+    for (size_t k=0; k < key_columns.size(); k++) {
+      key[k >> 6] |= uint64_t(dnf.get(r, key_columns[k])) << (k & 63);
+    }
+    hashes[i] = hash_key(key.data(), key_words);
+  }
+  std::sort(hashes.begin(), hashes.end());
+  return hashes;
+}
+
+size_t DNF::estimate_merge_rows(const DNF& a, const DNF& b) {
+  if (a.total_rows() == 0 or b.total_rows() == 0) {
+    return 0;
+  }
+  vector<size_t> shared_col_a, shared_col_b;
+  for (size_t j=0; j < b.variables.size(); j++) {
+    auto it = find(a.variables.begin(), a.variables.end(), b.variables[j]);
+    if (it != a.variables.end()) {
+      shared_col_a.push_back(it - a.variables.begin());
+      shared_col_b.push_back(j);
+    }
+  }
+  double estimate = double(a.total_rows()) * b.total_rows();
+  if (a.join or b.join) {
+    // Rows of a lazy merge are not stored, so fall back to treating the shared
+    // variables as independent, using how often each is true in each input
+    for (size_t k=0; k < shared_col_a.size(); k++) {
+      const double true_a = double(a.column_ones(shared_col_a[k])) / a.total_rows();
+      const double true_b = double(b.column_ones(shared_col_b[k])) / b.total_rows();
+      estimate *= true_a * true_b + (1 - true_a) * (1 - true_b);
+    }
+  } else if (not shared_col_a.empty()) {
+    // Count the pairs of sampled rows whose shared keys match, then scale up to
+    // every pair of rows
+    const auto hashes_a = sample_key_hashes(a, shared_col_a);
+    const auto hashes_b = sample_key_hashes(b, shared_col_b);
+    double matches = 0;
+    for (size_t i=0, j=0; i < hashes_a.size() and j < hashes_b.size();) {
+      if (hashes_a[i] < hashes_b[j]) {
+        i++;
+      } else if (hashes_b[j] < hashes_a[i]) {
+        j++;
+      } else {
+        const uint64_t key = hashes_a[i];
+        size_t count_a = 0, count_b = 0;
+        for (; i < hashes_a.size() and hashes_a[i] == key; i++) {
+          count_a++;
+        }
+        for (; j < hashes_b.size() and hashes_b[j] == key; j++) {
+          count_b++;
+        }
+        matches += double(count_a) * count_b;
+      }
+    }
+    estimate *= matches / (double(hashes_a.size()) * hashes_b.size());
+  }
+  if (estimate >= double(NO_ROW_LIMIT)) {
+    return NO_ROW_LIMIT;
+  }
+  return size_t(estimate + 0.5);
 }
 
 DNF DNF::merge(const DNF& a, const DNF& b) {
-  // Construct variable to column mappings for both functions
-  unordered_map<size_t, size_t> var_to_col_a, var_to_col_b;
+  DNF result;
+  const bool merged = try_merge(a, b, NO_ROW_LIMIT, result);
+  assert(merged);
+  (void) merged;
+  return result;
+}
+
+bool DNF::try_merge(const DNF& a, const DNF& b, size_t row_limit, DNF& result) {
+  if (a.small and b.small) {
+    size_t total = a.variables.size();
+    for (const auto v : b.variables) {
+      total += find(a.variables.begin(), a.variables.end(), v) == a.variables.end();
+    }
+    if (total <= SMALL_LIMIT) {
+      // At most 64 rows, so there is nothing to save by counting first
+      DNF merged = merge_small(a, b);
+      if (merged.rows > row_limit) {
+        return false;
+      }
+      result = std::move(merged);
+      return true;
+    }
+  }
+  if (a.join or b.join) {
+    DNF materialized_a(a), materialized_b(b);
+    materialized_a.materialize();
+    materialized_b.materialize();
+    return try_merge(materialized_a, materialized_b, row_limit, result);
+  }
+  if (a.small) {
+    return try_merge(a.expanded(), b, row_limit, result);
+  }
+  if (b.small) {
+    return try_merge(a, b.expanded(), row_limit, result);
+  }
+  // Construct variable to column mappings for "a"
+  unordered_map<size_t, size_t> var_to_col_a;
   for (size_t i=0; i < a.variables.size(); i++) {
     var_to_col_a[a.variables[i]] = i;
   }
-  for (size_t i=0; i < b.variables.size(); i++) {
-    var_to_col_b[b.variables[i]] = i;
-  }
 
-  // Find the set of shared variables
-  vector<size_t> shared_var;
-  vector<size_t> b_only_var;
-  for (const auto v : b.variables) {
-    if (var_to_col_a.count(v) == 1) {
+  // Find the set of shared variables, and where they are in each table
+  vector<size_t> shared_col_a, shared_col_b;
+  vector<size_t> b_only_col;
+  for (size_t i=0; i < b.variables.size(); i++) {
+    auto it = var_to_col_a.find(b.variables[i]);
+    if (it != var_to_col_a.end()) {
       // If "v", which we know is in b, is also in a
-      shared_var.push_back(v);
+      shared_col_a.push_back(it->second);
+      shared_col_b.push_back(i);
     } else {
       // Only in b
-      b_only_var.push_back(v);
+      b_only_col.push_back(i);
     }
   }
-  // Group rows in "a" by their key
-  std::unordered_map<vector<bool>, vector<vector<bool>>> key_to_a_rows;
-  for (const auto row : a.table) {
-    auto key = extract_key(shared_var, var_to_col_a, row);
-    key_to_a_rows[key].push_back(row);
+  // Large merges spread each step across the thread pool. Splitting the rows
+  // of "a" into partitions by hash lets each partition be indexed separately.
+  // Every bucket still lists its rows in order, so the result is identical
+  // no matter how many threads or partitions are used.
+  const bool parallel = ThreadPool::global().size() > 1 and a.rows + b.rows >= parallel_merge_rows;
+  const size_t partition_bits = parallel ? MERGE_PARTITION_BITS : 0;
+  const size_t partitions = size_t(1) << partition_bits;
+  auto partition_of = [partition_bits](uint64_t hash) {
+    return partition_bits == 0 ? 0 : size_t(hash >> (64 - partition_bits));
+  };
+  const size_t chunk_rows = MERGE_CHUNK_WORDS * 64;
+
+  // Pack each row's shared variables into integer keys
+  const size_t key_words = std::max<size_t>(1, (shared_col_a.size() + 63) >> 6);
+  const auto keys_a = a.pack_keys(shared_col_a, key_words, parallel);
+  const auto keys_b = b.pack_keys(shared_col_b, key_words, parallel);
+  vector<uint64_t> hash_a(a.rows);
+  for_each_index(parallel, parallel ? (a.rows + chunk_rows - 1) / chunk_rows : 1, [&](size_t chunk) {
+    const size_t end = parallel ? std::min(a.rows, (chunk + 1) * chunk_rows) : a.rows;
+    for (size_t r=chunk * chunk_rows; r < end; r++) {
+      hash_a[r] = hash_key(keys_a.data() + r * key_words, key_words);
+    }
+  });
+
+  // Gather the rows of "a" in each partition, keeping them in order
+  vector<size_t> partition_start(partitions + 1, 0);
+  for (const auto hash : hash_a) {
+    partition_start[partition_of(hash) + 1]++;
   }
-  vector<vector<bool>> table;
-  for (const auto b_row : b.table) {
-    auto key = extract_key(shared_var, var_to_col_b, b_row);
-    // Iterate over mergable rows, creating copies
-    for (auto new_row : key_to_a_rows[key]) {
-      // Add the variables that are only in b
-      for (const auto v : b_only_var) {
-        new_row.push_back(b_row[var_to_col_b[v]]);
+  for (size_t p=1; p <= partitions; p++) {
+    partition_start[p] += partition_start[p - 1];
+  }
+  vector<size_t> partition_rows(a.rows);
+  {
+    vector<size_t> next(partition_start.begin(), partition_start.end() - 1);
+    for (size_t r=0; r < a.rows; r++) {
+      partition_rows[next[partition_of(hash_a[r])]++] = r;
+    }
+  }
+  // Group rows in "a" by their key, referring to rows by index
+  vector<KeyIndex> indexes;
+  for (size_t p=0; p < partitions; p++) {
+    indexes.emplace_back(key_words, partition_start[p + 1] - partition_start[p]);
+  }
+  vector<size_t> bucket_of_a(a.rows);
+  for_each_index(parallel, partitions, [&](size_t p) {
+    for (size_t i=partition_start[p]; i < partition_start[p + 1]; i++) {
+      const size_t r = partition_rows[i];
+      bucket_of_a[r] = indexes[p].insert(keys_a.data() + r * key_words, hash_a[r]);
+    }
+  });
+  // Number the buckets of all partitions end to end
+  vector<size_t> bucket_offset(partitions + 1, 0);
+  for (size_t p=0; p < partitions; p++) {
+    bucket_offset[p + 1] = bucket_offset[p] + indexes[p].size();
+  }
+  // Lay the rows of each bucket out contiguously, keeping them in order
+  vector<size_t> bucket_start(bucket_offset.back() + 1, 0);
+  vector<size_t> a_rows(a.rows);
+  for_each_index(parallel, partitions, [&](size_t p) {
+    // Partitions own disjoint ranges of buckets
+    for (size_t i=partition_start[p]; i < partition_start[p + 1]; i++) {
+      const size_t r = partition_rows[i];
+      bucket_of_a[r] += bucket_offset[p];
+      bucket_start[bucket_of_a[r] + 1]++;
+    }
+  });
+  for (size_t i=1; i < bucket_start.size(); i++) {
+    bucket_start[i] += bucket_start[i - 1];
+  }
+  for_each_index(parallel, partitions, [&](size_t p) {
+    vector<size_t> next(bucket_start.begin() + bucket_offset[p], bucket_start.begin() + bucket_offset[p + 1]);
+    for (size_t i=partition_start[p]; i < partition_start[p + 1]; i++) {
+      const size_t r = partition_rows[i];
+      a_rows[next[bucket_of_a[r] - bucket_offset[p]]++] = r;
+    }
+  });
+
+  // Find the bucket each row of "b" joins with, and how big the result will be
+  vector<size_t> bucket_of_b(b.rows);
+  const size_t b_chunks = parallel ? (b.rows + chunk_rows - 1) / chunk_rows : 1;
+  vector<size_t> chunk_total(b_chunks, 0);
+  for_each_index(parallel, b_chunks, [&](size_t chunk) {
+    const size_t end = parallel ? std::min(b.rows, (chunk + 1) * chunk_rows) : b.rows;
+    for (size_t r=chunk * chunk_rows; r < end; r++) {
+      const uint64_t* key = keys_b.data() + r * key_words;
+      const uint64_t hash = hash_key(key, key_words);
+      const size_t p = partition_of(hash);
+      auto bucket = indexes[p].find(key, hash);
+      if (bucket != KeyIndex::NO_BUCKET) {
+        bucket += bucket_offset[p];
+        chunk_total[chunk] += bucket_start[bucket + 1] - bucket_start[bucket];
       }
-      table.push_back(new_row);
+      bucket_of_b[r] = bucket;
     }
+  });
+  size_t total_rows = 0;
+  for (const auto total : chunk_total) {
+    total_rows += total;
+  }
+  if (total_rows > row_limit) {
+    return false;
   }
+
   // Create the variable headers
-  vector<size_t> variables(a.variables.begin(), a.variables.end());
-  variables.insert(variables.end(), b_only_var.begin(), b_only_var.end());
-  return DNF(variables, table);
+  result = DNF();
+  result.variables = a.variables;
+  for (const auto c : b_only_col) {
+    result.variables.push_back(b.variables[c]);
+  }
+  result.allocate(total_rows);
+  // Each row of "b" is followed by all of its matching rows in "a".
+  // Every output column is its own range of words, so columns are filled in parallel.
+  for_each_index(parallel, result.variables.size(), [&](size_t c) {
+    result.fill_merged_column(c, a, b, b_only_col, bucket_of_b, bucket_start, a_rows);
+  });
+  result.shrink_if_small();
+  if (not result.small) {
+    result.compute_signatures(parallel);
+  }
+  return true;
+}
+
+DNF DNF::canonical() const {
+  if (join) {
+    DNF materialized(*this);
+    materialized.materialize();
+    return materialized.canonical();
+  }
+  if (small) {
+    return expanded().canonical();
+  }
+  // Columns in increasing order of their variables
+  vector<size_t> order(variables.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+    return variables[x] < variables[y];
+  });
+  // Each row's key is its truth table position, compared from the most significant word
+  const size_t key_words = std::max<size_t>(1, (order.size() + 63) >> 6);
+  const auto keys = pack_keys(order, key_words, false);
+  auto key_less = [&](size_t x, size_t y) {
+    for (size_t w=key_words; w-- > 0;) {
+      if (keys[x * key_words + w] != keys[y * key_words + w]) {
+        return keys[x * key_words + w] < keys[y * key_words + w];
+      }
+    }
+    return false;
+  };
+  vector<size_t> sorted_rows(rows);
+  std::iota(sorted_rows.begin(), sorted_rows.end(), 0);
+  std::sort(sorted_rows.begin(), sorted_rows.end(), key_less);
+  sorted_rows.erase(std::unique(sorted_rows.begin(), sorted_rows.end(), [&](size_t x, size_t y) {
+    return not key_less(x, y) and not key_less(y, x);
+  }), sorted_rows.end());
+
+  DNF result;
+  for (const auto c : order) {
+    result.variables.push_back(variables[c]);
+  }
+  result.allocate(sorted_rows.size());
+  for (size_t r=0; r < sorted_rows.size(); r++) {
+    const uint64_t* key = keys.data() + sorted_rows[r] * key_words;
+    for (size_t w=0; w < key_words; w++) {
+      for (uint64_t bits = key[w]; bits; bits &= bits - 1) {
+        result.set(r, (w << 6) + __builtin_ctzll(bits));
+      }
+    }
+  }
+  result.shrink_if_small();
+  if (not result.small) {
+    result.compute_signatures();
+  }
+  return result;
+}
+
+FunctionHash DNF::function_hash() const {
+  if (hash_known) {
+    return hash;
+  }
+  const DNF form = canonical();
+  // Two independent 64-bit hashes of the same values
+  hash = {0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL};
+  auto add = [&](uint64_t value) {
+    hash.low = (hash.low ^ value) * 0xbf58476d1ce4e5b9ULL;
+    hash.low ^= hash.low >> 31;
+    hash.high = (hash.high + value) * 0x94d049bb133111ebULL;
+    hash.high ^= hash.high >> 29;
+  };
+  add(form.variables.size());
+  for (const auto v : form.variables) {
+    add(v);
+  }
+  add(form.rows);
+  if (form.small) {
+    add(form.truth_table);
+  } else {
+    for (const auto word : form.table) {
+      add(word);
+    }
+  }
+  hash_known = true;
+  return hash;
+}
+
+bool DNF::same_function(const DNF& a, const DNF& b) {
+  if (a.variables.size() != b.variables.size() or a.function_hash() != b.function_hash()) {
+    return false;
+  }
+  const DNF x = a.canonical(), y = b.canonical();
+  return x.variables == y.variables and x.small == y.small and x.truth_table == y.truth_table
+      and x.rows == y.rows and x.table == y.table;
+}
+
+// Group of rows in "b" that match no row of "a"
+const size_t NO_GROUP = KeyIndex::NO_BUCKET;
+
+// The inputs of a lazy merge. Each keeps only rows that match some row of the
+// other, so each is exactly the merge's rows restricted to its own variables.
+size_t DNF::group_keys(const DNF& a, const vector<size_t>& shared_col_a, vector<size_t>& group_a,
+                       const DNF& b, const vector<size_t>& shared_col_b, vector<size_t>& group_b) {
+  const size_t key_words = std::max<size_t>(1, (shared_col_a.size() + 63) >> 6);
+  const auto keys_a = a.pack_keys(shared_col_a, key_words, false);
+  const auto keys_b = b.pack_keys(shared_col_b, key_words, false);
+  KeyIndex index(key_words, a.rows);
+  group_a.resize(a.rows);
+  for (size_t r=0; r < a.rows; r++) {
+    const uint64_t* key = keys_a.data() + r * key_words;
+    group_a[r] = index.insert(key, hash_key(key, key_words));
+  }
+  group_b.resize(b.rows);
+  for (size_t r=0; r < b.rows; r++) {
+    const uint64_t* key = keys_b.data() + r * key_words;
+    group_b[r] = index.find(key, hash_key(key, key_words));
+  }
+  return index.size();
+}
+
+void DNF::set_join(DNF&& a, DNF&& b) {
+  assert(not a.join and not b.join);
+  if (a.small) {
+    a = a.expanded();
+  }
+  if (b.small) {
+    b = b.expanded();
+  }
+  auto made = std::make_shared<Join>();
+  unordered_map<size_t, size_t> var_to_col_a;
+  for (size_t i=0; i < a.variables.size(); i++) {
+    var_to_col_a[a.variables[i]] = i;
+  }
+  for (size_t i=0; i < b.variables.size(); i++) {
+    auto it = var_to_col_a.find(b.variables[i]);
+    if (it != var_to_col_a.end()) {
+      made->shared_col_a.push_back(it->second);
+      made->shared_col_b.push_back(i);
+    } else {
+      made->b_only_col.push_back(i);
+    }
+  }
+  vector<size_t> group_a, group_b;
+  const size_t groups = group_keys(a, made->shared_col_a, group_a, b, made->shared_col_b, group_b);
+  vector<size_t> count_a(groups, 0), count_b(groups, 0);
+  for (const auto group : group_a) {
+    count_a[group]++;
+  }
+  for (const auto group : group_b) {
+    if (group != NO_GROUP) {
+      count_b[group]++;
+    }
+  }
+  size_t total_rows = 0;
+  for (size_t group=0; group < groups; group++) {
+    total_rows += count_a[group] * count_b[group];
+  }
+  // A row of one side is in as many merged rows as the other side has rows with its key
+  vector<size_t> merged_ones(a.variables.size() + made->b_only_col.size(), 0);
+  for (size_t c=0; c < a.variables.size(); c++) {
+    const uint64_t* column_c = a.column(c);
+    for (size_t w=0; w < a.words; w++) {
+      for (uint64_t bits = column_c[w]; bits != 0; bits &= bits - 1) {
+        merged_ones[c] += count_b[group_a[(w << 6) + __builtin_ctzll(bits)]];
+      }
+    }
+  }
+  for (size_t k=0; k < made->b_only_col.size(); k++) {
+    const uint64_t* column_c = b.column(made->b_only_col[k]);
+    for (size_t w=0; w < b.words; w++) {
+      for (uint64_t bits = column_c[w]; bits != 0; bits &= bits - 1) {
+        const size_t group = group_b[(w << 6) + __builtin_ctzll(bits)];
+        if (group != NO_GROUP) {
+          merged_ones[a.variables.size() + k] += count_a[group];
+        }
+      }
+    }
+  }
+  // Semi-join each side with the other, which keeps row order
+  vector<uint64_t> keep(a.words, 0);
+  for (size_t r=0; r < a.rows; r++) {
+    if (count_b[group_a[r]] > 0) {
+      keep[r >> 6] |= uint64_t(1) << (r & 63);
+    }
+  }
+  a.filter_rows(keep);
+  keep.assign(b.words, 0);
+  for (size_t r=0; r < b.rows; r++) {
+    if (group_b[r] != NO_GROUP) {
+      keep[r >> 6] |= uint64_t(1) << (r & 63);
+    }
+  }
+  b.filter_rows(keep);
+
+  variables = a.variables;
+  for (const auto c : made->b_only_col) {
+    variables.push_back(b.variables[c]);
+  }
+  small = false;
+  truth_table = 0;
+  table.clear();
+  table.shrink_to_fit();
+  clear_signatures();
+  ones = std::move(merged_ones);
+  words = 0;
+  rows = total_rows;
+  made->a = std::move(a);
+  made->b = std::move(b);
+  join = std::move(made);
+}
+
+bool DNF::try_lazy_merge(const DNF& a, const DNF& b, size_t row_limit, DNF& result) {
+  // The estimate is cheap, so only merges which look big pay for an exact count first
+  if (a.join or b.join or estimate_merge_rows(a, b) <= lazy_merge_rows) {
+    return try_merge(a, b, row_limit, result);
+  }
+  DNF lazy;
+  lazy.set_join(DNF(a), DNF(b));
+  if (lazy.rows > row_limit) {
+    return false;
+  }
+  if (lazy.rows <= lazy_merge_rows) {
+    lazy.materialize();
+  }
+  result = std::move(lazy);
+  return true;
+}
+
+void DNF::materialize() {
+  if (not join) {
+    return;
+  }
+  // Rows missing from the reduced inputs had no match, so the output is unchanged
+  const auto inputs = join;
+  const uint64_t before = version;
+  *this = merge(inputs->a, inputs->b);
+  version = before + 1;
+}
+
+size_t DNF::memory_bytes() const {
+  size_t total = vector_bytes(variables) + vector_bytes(table) + vector_bytes(ones)
+      + vector_bytes(fingerprints) + vector_bytes(row_weights);
+  if (join) {
+    total += sizeof(Join) + join->a.memory_bytes() + join->b.memory_bytes()
+        + vector_bytes(join->shared_col_a) + vector_bytes(join->shared_col_b) + vector_bytes(join->b_only_col);
+  }
+  return total;
+}
+
+size_t DNF::rows_within(size_t columns, size_t bytes, size_t row_bytes) {
+  // Each row costs a bit per column, its weight and "row_bytes", and each column
+  // its variable, count, fingerprint and at most one partly used word
+  const size_t fixed = columns * 4 * sizeof(uint64_t);
+  if (bytes <= fixed) {
+    return 0;
+  }
+  return (bytes - fixed) / (columns + 8 * (sizeof(uint64_t) + row_bytes)) * 8;
+}
+
+bool DNF::apply_knowledge_join(const Knowledge& knowledge) {
+  bool affected = false;
+  for (const auto v : variables) {
+    if (knowledge.is_assigned(v) or knowledge.is_rewritten(v)) {
+      affected = true;
+      break;
+    }
+  }
+  if (not affected) {
+    return false;
+  }
+  // Knowledge substitutes for variables, which can be done to each side of the join.
+  // A rewrite can make a variable shared, which the new join then matches on.
+  DNF a = join->a, b = join->b;
+  a.apply_knowledge_table(knowledge);
+  b.apply_knowledge_table(knowledge);
+  set_join(std::move(a), std::move(b));
+  if (rows <= lazy_merge_rows) {
+    materialize();
+  }
+  return true;
+}
+
+// Each group's value of "col", or empty if it varies within any group
+vector<signed char> group_profile(const DNF& dnf, size_t col, const vector<size_t>& group, size_t groups) {
+  vector<signed char> profile(groups, -1);
+  for (size_t r=0; r < group.size(); r++) {
+    const signed char value = dnf.get(r, col);
+    auto& seen = profile[group[r]];
+    if (seen == -1) {
+      seen = value;
+    } else if (seen != value) {
+      return {};
+    }
+  }
+  return profile;
+}
+
+Knowledge DNF::join_knowledge() const {
+  const DNF& a = join->a;
+  const DNF& b = join->b;
+  const auto& kernel = best_kernel();
+  // Every input row is part of some merged row, so each side's own constants and
+  // relations are exactly those of the merge restricted to its variables
+  const auto mask_a = a.row_mask();
+  const auto mask_b = b.row_mask();
+  auto found = all_pairs_relations(kernel, a.table.data(), a.variables.size(), a.words, mask_a.data());
+  const auto found_b = all_pairs_relations(kernel, b.table.data(), b.variables.size(), b.words, mask_b.data());
+  // Where each column of "b" is in the merge
+  vector<size_t> merged_col(b.variables.size());
+  for (size_t i=0; i < join->shared_col_b.size(); i++) {
+    merged_col[join->shared_col_b[i]] = join->shared_col_a[i];
+  }
+  for (size_t k=0; k < join->b_only_col.size(); k++) {
+    merged_col[join->b_only_col[k]] = a.variables.size() + k;
+  }
+  found.constant.resize(variables.size());
+  for (const auto c : join->b_only_col) {
+    found.constant[merged_col[c]] = found_b.constant[c];
+  }
+  for (const auto& relation : found_b.relations) {
+    found.relations.push_back({merged_col[relation.first], merged_col[relation.second], relation.negated});
+  }
+
+  // A variable only in "a" and one only in "b" are related exactly when each is
+  // constant within every group of rows sharing a key, and those constants always
+  // agree or always differ. Profiles are flipped to start with 0 so both cases match.
+  vector<size_t> group_a, group_b;
+  const size_t groups = group_keys(a, join->shared_col_a, group_a, b, join->shared_col_b, group_b);
+  vector<bool> shared_a(a.variables.size(), false);
+  for (const auto c : join->shared_col_a) {
+    shared_a[c] = true;
+  }
+  std::map<vector<signed char>, vector<std::pair<size_t, bool>>> a_profiles;
+  for (size_t c=0; c < a.variables.size(); c++) {
+    if (shared_a[c] or found.constant[c] != -1) {
+      continue;
+    }
+    auto profile = group_profile(a, c, group_a, groups);
+    if (profile.empty()) {
+      continue;
+    }
+    const bool flipped = profile[0] == 1;
+    for (auto& value : profile) {
+      value ^= flipped;
+    }
+    a_profiles[profile].push_back({c, flipped});
+  }
+  if (not a_profiles.empty()) {
+    for (const auto c : join->b_only_col) {
+      if (found_b.constant[c] != -1) {
+        continue;
+      }
+      auto profile = group_profile(b, c, group_b, groups);
+      if (profile.empty()) {
+        continue;
+      }
+      const bool flipped = profile[0] == 1;
+      for (auto& value : profile) {
+        value ^= flipped;
+      }
+      auto it = a_profiles.find(profile);
+      if (it == a_profiles.end()) {
+        continue;
+      }
+      for (const auto& match : it->second) {
+        found.relations.push_back({match.first, merged_col[c], match.second != flipped});
+      }
+    }
+  }
+  return relations_to_knowledge(variables, found);
 }
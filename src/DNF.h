@@ -7,32 +7,204 @@
 #include <vector>
 using std::vector;
 using std::size_t;
+#include <cassert>
+#include <cstdint>
 #include <iostream>
+#include <memory>
 
 #include "Knowledge.h"
+#include "SmallDNF.h"
+
+// Largest function a problem file may contain, so every row position fits in a word
+const size_t MAX_BLOCK_SIZE = 32;
+// Row limit that allows a merge of any size
+const size_t NO_ROW_LIMIT = ~size_t(0);
+
+class CheckpointWriter;
+class CheckpointReader;
+
+// 128-bit hash of a function, see "DNF::function_hash"
+struct FunctionHash {
+  uint64_t low, high;
+  bool operator==(const FunctionHash& other) const {
+    return low == other.low and high == other.high;
+  }
+  bool operator!=(const FunctionHash& other) const {
+    return not (*this == other);
+  }
+};
 
-// TODO Consider switching from "row x column to column x row"
 class DNF {
  public:
   DNF() = default;
-  DNF(vector<size_t>& var, vector<vector<bool>>& tab) : variables(var), table(tab) {
-
-  }
+  DNF(const vector<size_t>& var, const vector<vector<bool>>& tab);
+  // Builds a function of at most SMALL_LIMIT variables directly from its truth table
+  DNF(const vector<size_t>& var, uint64_t truth_table);
+  // Builds a function of any size from its truth table, stored as 64-bit words
+  // with the least significant first. Bit i is set if position i is a row.
+  DNF(const vector<size_t>& var, const vector<uint64_t>& truth_table);
   void print(std::ostream& out=std::cout) const;
   Knowledge create_knowledge() const;
   Knowledge create_knowledge_alternate() const;
   bool apply_knowledge(const Knowledge& knowledge);
-  const vector<size_t>& get_variables() {
+  const vector<size_t>& get_variables() const {
     return variables;
   }
-  const vector<vector<bool>>& get_table() {
-    return table;
+  size_t total_rows() const {
+    return rows;
   }
+  // Returns the value "variables[col]" takes in row "row"
+  bool get(size_t row, size_t col) const {
+    assert(not join);
+    if (small) {
+      return (small_position(row) >> col) & 1;
+    }
+    return (column(col)[row >> 6] >> (row & 63)) & 1;
+  }
+  // An assumption can hide rows without changing the table by using a mask of
+  // "mask_words()" words. A set bit keeps that row, or for small functions that
+  // truth table position. A lazy merge masks the rows of each input, first then
+  // second, which keeps a merged row only if both rows it joins are kept.
+  size_t mask_words() const;
+  // Sets "mask" to keep every row
+  void fill_mask(uint64_t* mask) const;
+  // Clears the rows of "mask" which contradict "knowledge"
+  void restrict(const Knowledge& knowledge, uint64_t* mask) const;
+  // Learns from only the rows kept by "mask". For a lazy merge this is what each
+  // input's kept rows imply on their own, which misses anything only the matching
+  // between them would show, but never learns something false.
+  Knowledge create_knowledge(const uint64_t* mask) const;
+  // Number of rows where "variables[col]" is true
+  size_t column_ones(size_t col) const;
+  // Merges whose inputs have this many rows in total are spread across ThreadPool::global()
+  static size_t parallel_merge_rows;
   static DNF merge(const DNF& a, const DNF& b);
+  // Merges into "result" only if the output has at most "row_limit" rows, which is
+  // checked after counting the output and before building it. Returns if it merged.
+  static bool try_merge(const DNF& a, const DNF& b, size_t row_limit, DNF& result);
+  // Predicts the rows "merge" will output by matching the shared variables of
+  // each input's rows. Exact when neither input has more rows than are sampled,
+  // which keeps the cost to a fixed number of rows per input.
+  static size_t estimate_merge_rows(const DNF& a, const DNF& b);
+  // Merges bigger than this are kept lazy by "try_lazy_merge"
+  static size_t lazy_merge_rows;
+  // As "try_merge", except a result of more than "lazy_merge_rows" rows is kept
+  // lazy, as the join of its inputs on their shared variables, until "materialize"
+  static bool try_lazy_merge(const DNF& a, const DNF& b, size_t row_limit, DNF& result);
+  bool is_lazy() const {
+    return join != nullptr;
+  }
+  // True if stored as a truth table (see SmallDNF.h)
+  bool is_small() const {
+    return small;
+  }
+  // Changes whenever the rows, or how they are stored, change in place, so
+  // anything kept per row (such as a row mask) can tell it is out of date
+  uint64_t get_version() const {
+    return version;
+  }
+  // Builds the rows of a lazy merge, in the same order "merge" would have
+  void materialize();
+  // The same function with its variables in increasing order and its rows sorted
+  // (as truth table positions) without duplicates
+  DNF canonical() const;
+  // Hash of "canonical", so any two DNFs of the same function hash the same.
+  // Kept until "apply_knowledge" changes the function, so it is not safe to
+  // call from more than one thread at once.
+  FunctionHash function_hash() const;
+  // True if "a" and "b" are the same function. Their canonical forms are only
+  // compared if their hashes match.
+  static bool same_function(const DNF& a, const DNF& b);
+  // Heap memory held by this DNF, including the inputs of a lazy merge
+  size_t memory_bytes() const;
+  // Most rows a table of "columns" variables can have in "bytes" of memory, when
+  // each row also needs "row_bytes" bytes outside the table
+  static size_t rows_within(size_t columns, size_t bytes, size_t row_bytes=0);
+  void save(CheckpointWriter& out) const;
+  void restore(CheckpointReader& in);
  private:
   vector<size_t> variables;
-  vector<vector<bool>> table;
+  // Functions with at most SMALL_LIMIT variables are stored in "truth_table"
+  // (see SmallDNF.h) and leave "table" empty. Rows are in increasing position order.
+  bool small = false;
+  uint64_t truth_table = 0;
+  // The table is stored column-major with each column packed into "words" uint64_t.
+  // Bit "r % 64" of word "r / 64" in a column is that variable's value in row "r".
+  // Bits past the last row are always kept at 0.
+  vector<uint64_t> table;
+  size_t rows = 0;
+  size_t words = 0;
+  // Set instead of the table for a lazy merge, where "rows" is the size of the join.
+  // Applying and creating knowledge, masks and column counts work on the inputs,
+  // and merging uses a materialized copy. Anything that reads rows requires
+  // "materialize" first.
+  struct Join;
+  std::shared_ptr<const Join> join;
+  // See "get_version"
+  uint64_t version = 0;
+  // Set by "function_hash" and valid while "hash_known". Not saved in checkpoints.
+  mutable FunctionHash hash = {0, 0};
+  mutable bool hash_known = false;
+  // Kept up to date as rows and columns are removed, only while using the table.
+  // "ones" counts each column's set bits, and its fingerprint is the sum of
+  // "row_weights" over those rows, so equal columns have equal fingerprints and
+  // opposite columns sum to "weight_total". A lazy merge keeps only "ones", for
+  // the merged rows. Not saved in checkpoints.
+  vector<size_t> ones;
+  vector<uint64_t> fingerprints;
+  vector<uint64_t> row_weights;
+  uint64_t weight_total = 0;
+  const uint64_t* column(size_t col) const {
+    return table.data() + col * words;
+  }
+  uint64_t* column(size_t col) {
+    return table.data() + col * words;
+  }
+  void set(size_t row, size_t col) {
+    column(col)[row >> 6] |= uint64_t(1) << (row & 63);
+  }
+  // Sets rows [begin, end) of a column
+  void set_range(size_t col, size_t begin, size_t end);
+  // Packs the values of "key_columns" in each row into "key_words" words per row
+  vector<uint64_t> pack_keys(const vector<size_t>& key_columns, size_t key_words, bool parallel) const;
+  // Writes output column "c" of "merge" given how rows of "a" were grouped
+  void fill_merged_column(size_t c, const DNF& a, const DNF& b, const vector<size_t>& b_only_col,
+                          const vector<size_t>& bucket_of_b, const vector<size_t>& bucket_start,
+                          const vector<size_t>& a_rows);
+  // Sets up an all zero table with the current variables and "total_rows" rows
+  void allocate(size_t total_rows);
+  // Mask of which bits in the final word of each column are in use
+  uint64_t tail_mask() const;
+  // One bit set for each row in the table
+  vector<uint64_t> row_mask() const;
   void remove_column(size_t i);
+  // Keeps only the rows with their bit set in "keep", preserving their order
+  void filter_rows(const vector<uint64_t>& keep);
+  // Rebuilds the column signatures from the table
+  void compute_signatures(bool parallel=false);
+  void clear_signatures();
+  // Finds constant and related columns from the signatures, comparing columns
+  // only when their fingerprints say they may be related
+  ColumnRelations signature_relations() const;
+
+  // Truth table position of the "row"-th row of a small function
+  size_t small_position(size_t row) const;
+  // Switches to the truth table if there are few enough variables
+  void shrink_if_small();
+  // Returns a copy stored in the column table, regardless of size
+  DNF expanded() const;
+  bool apply_knowledge_small(const Knowledge& knowledge);
+  bool apply_knowledge_table(const Knowledge& knowledge);
+  bool apply_knowledge_join(const Knowledge& knowledge);
+  // Becomes the lazy merge of "a" and "b", keeping only the rows of each that
+  // match some row of the other
+  void set_join(DNF&& a, DNF&& b);
+  Knowledge join_knowledge() const;
+  // Numbers the values rows take on the shared columns, setting the group of every
+  // row. Rows of "b" with no match in "a" are given NO_GROUP. Returns the group count.
+  static size_t group_keys(const DNF& a, const vector<size_t>& shared_col_a, vector<size_t>& group_a,
+                           const DNF& b, const vector<size_t>& shared_col_b, vector<size_t>& group_b);
+  static DNF merge_small(const DNF& a, const DNF& b);
 };
 
 #endif /* DNF_H_ */
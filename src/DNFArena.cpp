@@ -0,0 +1,266 @@
+#include "DNFArena.h"
+#include "Checkpoint.h"
+#include "MemoryUsage.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+
+// Generations wrap at this value, at which point a slot is retired instead of reused
+const uint32_t GENERATION_LIMIT = uint32_t(1) << (32 - DNFArena::SLOT_BITS);
+
+dnf_handle DNFArena::insert(DNF&& dnf) {
+  size_t slot;
+  if (free_slots.empty()) {
+    // The last slot is never used so that no handle equals NO_DNF
+    if (slots.size() >= SLOT_MASK) {
+      throw std::length_error("Too many DNFs for a 32-bit handle");
+    }
+    slot = slots.size();
+    slots.emplace_back();
+  } else {
+    slot = free_slots.back();
+    free_slots.pop_back();
+  }
+  auto& entry = slots[slot];
+  entry.dnf = std::move(dnf);
+  entry.handle = (entry.generation << SLOT_BITS) | slot;
+  entry.position = handles.size();
+  handles.push_back(entry.handle);
+  return entry.handle;
+}
+
+DNF DNFArena::take(dnf_handle handle) {
+  assert(contains(handle));
+  const size_t slot = slot_of(handle);
+  auto& entry = slots[slot];
+  DNF result = std::move(entry.dnf);
+  entry.dnf = DNF();
+  entry.handle = NO_DNF;
+  // Swap the last live handle into this one's position
+  const dnf_handle moved = handles.back();
+  handles[entry.position] = moved;
+  slots[slot_of(moved)].position = entry.position;
+  handles.pop_back();
+  entry.generation++;
+  if (entry.generation < GENERATION_LIMIT) {
+    free_slots.push_back(slot);
+  }
+  return result;
+}
+
+void DNFArena::clear() {
+  slots.clear();
+  free_slots.clear();
+  handles.clear();
+}
+
+size_t DNFArena::memory_bytes() const {
+  size_t total = vector_bytes(slots) + vector_bytes(free_slots) + vector_bytes(handles);
+  for (const auto handle : handles) {
+    total += slots[slot_of(handle)].dnf.memory_bytes();
+  }
+  return total;
+}
+
+void DNFArena::save(CheckpointWriter& out) const {
+  out.write(slots.size());
+  for (const auto& slot : slots) {
+    out.write(slot.handle);
+    out.write(slot.generation);
+    if (slot.handle != NO_DNF) {
+      slot.dnf.save(out);
+    }
+  }
+  out.write_vector(free_slots);
+  out.write_vector(handles);
+}
+
+void DNFArena::restore(CheckpointReader& in) {
+  clear();
+  slots.resize(in.read());
+  for (auto& slot : slots) {
+    slot.handle = in.read();
+    slot.generation = in.read();
+    if (slot.handle != NO_DNF) {
+      slot.dnf.restore(in);
+    }
+  }
+  in.read_vector(free_slots);
+  in.read_vector(handles);
+  for (size_t i=0; i < handles.size(); i++) {
+    const size_t slot = slot_of(handles[i]);
+    if (slot >= slots.size() or slots[slot].handle != handles[i]) {
+      in.error("function handles do not match their slots");
+    }
+    slots[slot].position = i;
+  }
+}
+
+const size_t HandleSet::NOT_MEMBER;
+
+bool HandleSet::insert(dnf_handle handle) {
+  const size_t slot = DNFArena::slot_of(handle);
+  if (slot >= positions.size()) {
+    positions.resize(slot + 1, NOT_MEMBER);
+  }
+  size_t& position = positions[slot];
+  if (position != NOT_MEMBER) {
+    if (members[position] == handle) {
+      return false;
+    }
+    // An older handle to the same slot can only refer to a removed DNF
+    members[position] = handle;
+    return true;
+  }
+  position = members.size();
+  members.push_back(handle);
+  return true;
+}
+
+bool HandleSet::erase(dnf_handle handle) {
+  if (not contains(handle)) {
+    return false;
+  }
+  const size_t slot = DNFArena::slot_of(handle);
+  const dnf_handle moved = members.back();
+  members[positions[slot]] = moved;
+  positions[DNFArena::slot_of(moved)] = positions[slot];
+  members.pop_back();
+  positions[slot] = NOT_MEMBER;
+  return true;
+}
+
+void HandleSet::clear() {
+  for (const auto handle : members) {
+    positions[DNFArena::slot_of(handle)] = NOT_MEMBER;
+  }
+  members.clear();
+}
+
+size_t HandleSet::memory_bytes() const {
+  return vector_bytes(positions) + vector_bytes(members);
+}
+
+void HandleSet::save(CheckpointWriter& out) const {
+  out.write_vector(members);
+}
+
+void HandleSet::restore(CheckpointReader& in) {
+  clear();
+  vector<dnf_handle> saved;
+  in.read_vector(saved);
+  insert(saved.begin(), saved.end());
+}
+
+// Bit of a scope's signature set by "variable"
+uint64_t signature_bit(size_t variable) {
+  // Nearby variables are often used together, so spread them across the bits
+  return uint64_t(1) << ((variable * 0x9e3779b97f4a7c15ULL) >> 58);
+}
+
+void ScopeIndex::set(dnf_handle handle, const vector<size_t>& variables) {
+  const size_t slot = DNFArena::slot_of(handle);
+  if (slot >= scopes.size()) {
+    scopes.resize(slot + 1);
+  }
+  unlink(handle);
+  auto& scope = scopes[slot];
+  scope.owner = handle;
+  scope.variables.assign(variables.begin(), variables.end());
+  std::sort(scope.variables.begin(), scope.variables.end());
+  scope.signature = 0;
+  scope.hash = scope.variables.size();
+  for (const auto v : scope.variables) {
+    scope.signature |= signature_bit(v);
+    scope.hash = (scope.hash ^ v) * 0xbf58476d1ce4e5b9ULL;
+    scope.hash ^= scope.hash >> 31;
+  }
+  by_hash.emplace(scope.hash, handle);
+  if (not scope.variables.empty()) {
+    const size_t first = scope.variables.front();
+    if (first >= by_first.size()) {
+      by_first.resize(first + 1);
+    }
+    scope.first_position = by_first[first].size();
+    by_first[first].push_back(handle);
+  }
+}
+
+void ScopeIndex::erase(dnf_handle handle) {
+  const size_t slot = DNFArena::slot_of(handle);
+  if (slot < scopes.size() and scopes[slot].owner == handle) {
+    unlink(handle);
+    scopes[slot].owner = NO_DNF;
+    scopes[slot].variables.clear();
+  }
+}
+
+void ScopeIndex::unlink(dnf_handle handle) {
+  const size_t slot = DNFArena::slot_of(handle);
+  if (slot >= scopes.size() or scopes[slot].owner == NO_DNF) {
+    return;
+  }
+  const auto& scope = scopes[slot];
+  if (not scope.variables.empty()) {
+    // Swap the last of the list into its place
+    auto& listed = by_first[scope.variables.front()];
+    const dnf_handle last = listed.back();
+    listed[scope.first_position] = last;
+    scopes[DNFArena::slot_of(last)].first_position = scope.first_position;
+    listed.pop_back();
+  }
+  // A slot only ever has one entry, made by whichever handle last used it
+  auto range = by_hash.equal_range(scope.hash);
+  for (auto it = range.first; it != range.second; it++) {
+    if (it->second == scope.owner) {
+      by_hash.erase(it);
+      return;
+    }
+  }
+}
+
+size_t ScopeIndex::memory_bytes() const {
+  size_t total = vector_bytes(scopes) + hash_table_bytes(by_hash) + vector_bytes(by_first);
+  for (const auto& scope : scopes) {
+    total += vector_bytes(scope.variables);
+  }
+  for (const auto& listed : by_first) {
+    total += vector_bytes(listed);
+  }
+  return total;
+}
+
+dnf_handle ScopeIndex::find_same(dnf_handle handle) const {
+  const auto& target = scope(handle);
+  auto range = by_hash.equal_range(target.hash);
+  for (auto it = range.first; it != range.second; it++) {
+    if (it->second != handle and scope(it->second).variables == target.variables) {
+      return it->second;
+    }
+  }
+  return NO_DNF;
+}
+
+dnf_handle ScopeIndex::find_subset(dnf_handle handle) const {
+  const auto& target = scope(handle);
+  for (const auto v : target.variables) {
+    if (v >= by_first.size()) {
+      break;
+    }
+    for (const auto candidate : by_first[v]) {
+      if (candidate != handle and contains(handle, candidate)) {
+        return candidate;
+      }
+    }
+  }
+  return NO_DNF;
+}
+
+bool ScopeIndex::contains(dnf_handle outer, dnf_handle inner) const {
+  const auto& a = scope(outer);
+  const auto& b = scope(inner);
+  if ((b.signature & ~a.signature) != 0 or b.variables.size() > a.variables.size()) {
+    return false;
+  }
+  return std::includes(a.variables.begin(), a.variables.end(), b.variables.begin(), b.variables.end());
+}
@@ -0,0 +1,168 @@
+// Owns every DNF in a problem, stored in reusable slots and referred to by
+// 32-bit handles. A handle holds its slot index and the generation of the
+// slot when it was issued, so handles to removed DNFs are detected instead of
+// silently referring to whatever later reuses the slot.
+#ifndef DNFARENA_H_
+#define DNFARENA_H_
+
+#include <cassert>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+using std::vector;
+
+#include "DNF.h"
+
+using dnf_handle = uint32_t;
+// Never refers to a DNF
+const dnf_handle NO_DNF = ~dnf_handle(0);
+
+class DNFArena {
+ public:
+  // Low bits of a handle are the slot, high bits are the generation
+  static const unsigned SLOT_BITS = 24;
+  static const uint32_t SLOT_MASK = (uint32_t(1) << SLOT_BITS) - 1;
+  static size_t slot_of(dnf_handle handle) {
+    return handle & SLOT_MASK;
+  }
+
+  dnf_handle insert(DNF&& dnf);
+  // Removes the DNF, returning it so the caller can keep using it
+  DNF take(dnf_handle handle);
+  void erase(dnf_handle handle) {
+    take(handle);
+  }
+  bool contains(dnf_handle handle) const {
+    const size_t slot = slot_of(handle);
+    return slot < slots.size() and slots[slot].handle == handle;
+  }
+  DNF& operator[](dnf_handle handle) {
+    return slots[slot_of(handle)].dnf;
+  }
+  const DNF& operator[](dnf_handle handle) const {
+    return slots[slot_of(handle)].dnf;
+  }
+  // Handles of every DNF currently stored, in no particular order
+  const vector<dnf_handle>& live() const {
+    return handles;
+  }
+  size_t size() const {
+    return handles.size();
+  }
+  bool empty() const {
+    return handles.empty();
+  }
+  // Upper bound on slot_of for any handle issued so far
+  size_t slot_count() const {
+    return slots.size();
+  }
+  void clear();
+  // Heap memory held by the arena and every DNF in it
+  size_t memory_bytes() const;
+  // Restoring keeps every handle, so handles saved elsewhere stay valid
+  void save(CheckpointWriter& out) const;
+  void restore(CheckpointReader& in);
+ private:
+  struct Slot {
+    DNF dnf;
+    // Handle currently stored here, or NO_DNF if the slot is free
+    dnf_handle handle = NO_DNF;
+    uint32_t generation = 0;
+    // Where this slot's handle is in "handles"
+    size_t position = 0;
+  };
+  vector<Slot> slots;
+  vector<uint32_t> free_slots;
+  vector<dnf_handle> handles;
+};
+
+// A set of handles supporting constant time insert, erase and lookup
+class HandleSet {
+ public:
+  bool insert(dnf_handle handle);
+  template <class Iterator>
+  void insert(Iterator begin, Iterator end) {
+    for (; begin != end; begin++) {
+      insert(*begin);
+    }
+  }
+  bool erase(dnf_handle handle);
+  bool contains(dnf_handle handle) const {
+    const size_t slot = DNFArena::slot_of(handle);
+    return slot < positions.size() and positions[slot] != NOT_MEMBER and members[positions[slot]] == handle;
+  }
+  const vector<dnf_handle>& handles() const {
+    return members;
+  }
+  vector<dnf_handle>::const_iterator begin() const {
+    return members.begin();
+  }
+  vector<dnf_handle>::const_iterator end() const {
+    return members.end();
+  }
+  size_t size() const {
+    return members.size();
+  }
+  bool empty() const {
+    return members.empty();
+  }
+  void clear();
+  size_t memory_bytes() const;
+  // Saves the members in order
+  void save(CheckpointWriter& out) const;
+  void restore(CheckpointReader& in);
+ private:
+  static const size_t NOT_MEMBER = ~size_t(0);
+  // Indexed by slot, where that slot's handle is in "members"
+  vector<size_t> positions;
+  vector<dnf_handle> members;
+};
+
+// The variables of each DNF as a sorted set, along with a 64-bit signature
+// with one bit set per variable. One scope can only contain another if its
+// signature has every bit of the other's, which rejects most pairs without
+// comparing the sets. Scopes are also hashed, to find equal scopes directly,
+// and listed under their smallest variable, to find the scopes another contains.
+class ScopeIndex {
+ public:
+  // Records (or replaces) the variables of "handle"
+  void set(dnf_handle handle, const vector<size_t>& variables);
+  void erase(dnf_handle handle);
+  void clear() {
+    scopes.clear();
+    by_hash.clear();
+    by_first.clear();
+  }
+  // True if every variable of "inner" is also a variable of "outer"
+  bool contains(dnf_handle outer, dnf_handle inner) const;
+  // Another DNF with exactly the variables of "handle", or NO_DNF if there is none
+  dnf_handle find_same(dnf_handle handle) const;
+  // Another DNF with at least one variable, all of which are variables of
+  // "handle", or NO_DNF if there is none
+  dnf_handle find_subset(dnf_handle handle) const;
+  size_t memory_bytes() const;
+ private:
+  struct Scope {
+    dnf_handle owner = NO_DNF;
+    uint64_t signature = 0;
+    uint64_t hash = 0;
+    vector<size_t> variables;
+    // Where "owner" is in the "by_first" list of its smallest variable
+    size_t first_position = 0;
+  };
+  // Indexed by slot
+  vector<Scope> scopes;
+  // Every recorded handle, by the hash of its scope
+  std::unordered_multimap<uint64_t, dnf_handle> by_hash;
+  // Indexed by variable, the handles whose smallest variable it is. A subset's
+  // smallest variable is in the scope containing it, so only those lists are searched.
+  vector<vector<dnf_handle>> by_first;
+  // Removes "handle" from "by_hash" and "by_first" if it is there
+  void unlink(dnf_handle handle);
+  const Scope& scope(dnf_handle handle) const {
+    assert(DNFArena::slot_of(handle) < scopes.size() and scopes[DNFArena::slot_of(handle)].owner == handle);
+    return scopes[DNFArena::slot_of(handle)];
+  }
+};
+
+#endif /* DNFARENA_H_ */
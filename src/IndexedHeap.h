@@ -0,0 +1,182 @@
+// A binary min-heap of DNF handles whose keys can be changed after insertion.
+// Each handle's position in the heap is indexed by its arena slot, so finding,
+// updating or removing an entry is O(log n) without any searching. Equal keys
+// are ordered by handle, so the order never depends on insertion history.
+#ifndef INDEXEDHEAP_H_
+#define INDEXEDHEAP_H_
+
+#include <vector>
+using std::vector;
+#include <utility>
+
+#include "DNFArena.h"
+#include "MemoryUsage.h"
+
+template <class Key>
+class IndexedHeap {
+ public:
+  // Adds "handle", or changes its key if it is already in the heap
+  void push(dnf_handle handle, const Key& key) {
+    const size_t slot = DNFArena::slot_of(handle);
+    if (slot >= positions.size()) {
+      positions.resize(slot + 1, NOT_MEMBER);
+    }
+    size_t position = positions[slot];
+    if (position == NOT_MEMBER) {
+      position = entries.size();
+      entries.push_back({key, handle});
+      positions[slot] = position;
+    } else {
+      // Replaces the key (and any older handle to the same slot, which must have been removed)
+      entries[position] = {key, handle};
+      position = sift_down(position);
+    }
+    sift_up(position);
+  }
+  bool erase(dnf_handle handle) {
+    if (not contains(handle)) {
+      return false;
+    }
+    const size_t position = positions[DNFArena::slot_of(handle)];
+    positions[DNFArena::slot_of(handle)] = NOT_MEMBER;
+    if (position + 1 == entries.size()) {
+      entries.pop_back();
+      return true;
+    }
+    // Fill the hole with the last entry, which can then move either way
+    entries[position] = entries.back();
+    entries.pop_back();
+    positions[DNFArena::slot_of(entries[position].handle)] = position;
+    sift_up(sift_down(position));
+    return true;
+  }
+  bool contains(dnf_handle handle) const {
+    const size_t slot = DNFArena::slot_of(handle);
+    return slot < positions.size() and positions[slot] != NOT_MEMBER
+        and entries[positions[slot]].handle == handle;
+  }
+  // The handle with the smallest key
+  dnf_handle top() const {
+    return entries.empty() ? NO_DNF : entries[0].handle;
+  }
+  // The handle with the second smallest key, which is always a child of the top
+  dnf_handle second() const {
+    if (entries.size() < 2) {
+      return NO_DNF;
+    }
+    if (entries.size() == 2 or before(entries[1], entries[2])) {
+      return entries[1].handle;
+    }
+    return entries[2].handle;
+  }
+  // The "count" handles with the smallest keys, smallest first
+  vector<dnf_handle> best(size_t count) const {
+    vector<dnf_handle> result;
+    // Positions whose parents have been taken, one of which is always next
+    vector<size_t> frontier;
+    if (not entries.empty()) {
+      frontier.push_back(0);
+    }
+    while (result.size() < count and not frontier.empty()) {
+      size_t chosen = 0;
+      for (size_t i=1; i < frontier.size(); i++) {
+        if (before(entries[frontier[i]], entries[frontier[chosen]])) {
+          chosen = i;
+        }
+      }
+      const size_t position = frontier[chosen];
+      frontier[chosen] = frontier.back();
+      frontier.pop_back();
+      result.push_back(entries[position].handle);
+      for (size_t child=2 * position + 1; child <= 2 * position + 2 and child < entries.size(); child++) {
+        frontier.push_back(child);
+      }
+    }
+    return result;
+  }
+  size_t size() const {
+    return entries.size();
+  }
+  bool empty() const {
+    return entries.empty();
+  }
+  // Every handle in the heap, in no particular order
+  vector<dnf_handle> handles() const {
+    vector<dnf_handle> result;
+    result.reserve(entries.size());
+    for (const auto& entry : entries) {
+      result.push_back(entry.handle);
+    }
+    return result;
+  }
+  void clear() {
+    for (const auto& entry : entries) {
+      positions[DNFArena::slot_of(entry.handle)] = NOT_MEMBER;
+    }
+    entries.clear();
+  }
+  size_t memory_bytes() const {
+    return vector_bytes(entries) + vector_bytes(positions);
+  }
+ private:
+  static const size_t NOT_MEMBER = ~size_t(0);
+  struct Entry {
+    Key key;
+    dnf_handle handle;
+  };
+  vector<Entry> entries;
+  // Indexed by slot, where that slot's handle is in "entries"
+  vector<size_t> positions;
+
+  static bool before(const Entry& a, const Entry& b) {
+    if (a.key < b.key) {
+      return true;
+    }
+    if (b.key < a.key) {
+      return false;
+    }
+    return a.handle < b.handle;
+  }
+  void place(size_t position, Entry&& entry) {
+    positions[DNFArena::slot_of(entry.handle)] = position;
+    entries[position] = std::move(entry);
+  }
+  // Both return the entry's final position
+  size_t sift_up(size_t position) {
+    Entry moving = std::move(entries[position]);
+    while (position > 0) {
+      const size_t parent = (position - 1) / 2;
+      if (not before(moving, entries[parent])) {
+        break;
+      }
+      place(position, std::move(entries[parent]));
+      position = parent;
+    }
+    place(position, std::move(moving));
+    return position;
+  }
+  size_t sift_down(size_t position) {
+    Entry moving = std::move(entries[position]);
+    while (true) {
+      size_t child = 2 * position + 1;
+      if (child >= entries.size()) {
+        break;
+      }
+      if (child + 1 < entries.size() and before(entries[child + 1], entries[child])) {
+        child++;
+      }
+      if (not before(entries[child], moving)) {
+        break;
+      }
+      place(position, std::move(entries[child]));
+      position = child;
+    }
+    place(position, std::move(moving));
+    return position;
+  }
+};
+
+template <class Key>
+const size_t IndexedHeap<Key>::NOT_MEMBER;
+
+#endif /* INDEXEDHEAP_H_ */
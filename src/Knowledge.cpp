@@ -6,151 +6,179 @@
  */
 
 #include "Knowledge.h"
+#include "Checkpoint.h"
 #include <cassert>
 using std::endl;
 
-unordered_set<size_t> Knowledge::add(const size_t variable, const bool value) {
-  auto rewrite_it = rewrites.find(variable);
-  // If "variable" is currently being rewriten to something else
-  // step forward to it and recurse
-  if (rewrite_it != rewrites.end()) {
-    auto new_variable = rewrite_it->second.to;
-    auto new_value = value;
-    if (rewrite_it->second.negated) {
-      new_value = not new_value;
-    }
-    // recurse
-    return add(new_variable, new_value);
-  }
-  // Build up the list of everything that can be assigned using this knowledge
-  std::vector<std::pair<size_t, bool>> new_assignments;
-  new_assignments.emplace_back(variable, value);
-  // Find everything that rewrites to "variable"
-  auto it = sources.find(variable);
-  if (it != sources.end()) {
-    // For each thing that can rewrite to this
-    for (const auto new_variable : it->second) {
-      // TODO might be better to explicitly use iterators here
-      auto & rewrite = rewrites[new_variable];
-      auto new_value = value;
-      if (rewrite.negated) {
-        new_value = not value;
-      }
-      new_assignments.emplace_back(new_variable, new_value);
-      // Delete the rule
-      rewrites.erase(new_variable);
-      // Warning, at this point "rewrite" is invalid
-    }
-    // Delete the sources for this rule
-    sources.erase(it);
-  }
-  unordered_set<size_t> updated;
-  // Integrate assignments, check for UNSAT
-  for (const auto assignment : new_assignments) {
-    auto result = assigned.insert(assignment);
-    if (not result.second) {
-      // If you have seen this assignment before
-      if (result.first->second != assignment.second) {
-        // This new assignment contradicts a previous assignment
-        is_unsat = true;
-      }
-    } else {
-      updated.insert(assignment.first);
-    }
+const signed char Knowledge::UNKNOWN;
+
+void Knowledge::grow(const size_t variable) {
+  assert(variable < UINT32_MAX);
+  while (nodes.size() <= variable) {
+    const uint32_t v = nodes.size();
+    nodes.emplace_back();
+    nodes.back().parent = nodes.back().next = nodes.back().minimum = v;
   }
-  return updated;
 }
 
-unordered_set<size_t> Knowledge::add(const TwoConsistency& rewrite) {
-  if (assigned.count(rewrite.from)) {
-    // "from" is already assigned, so assign "to" as well
-    auto value = assigned[rewrite.from];
-    if (rewrite.negated) {
-      value = not value;
+void Knowledge::add(const size_t variable, const bool value, UpdatedVariables* updated) {
+  grow(variable);
+  const size_t root = nodes[variable].parent;
+  // The value "variable" needs its root to have
+  const bool root_value = value != nodes[variable].parity;
+  if (nodes[root].value != UNKNOWN) {
+    if (nodes[root].value != root_value) {
+      // This new assignment contradicts a previous assignment
+      is_unsat = true;
     }
-    return add(rewrite.to, value);
-  } else if (assigned.count(rewrite.to)) {
-    // "to" is already assigned, so assign "from" as well
-    auto value = assigned[rewrite.to];
-    if (rewrite.negated) {
-      value = not value;
-    }
-    return add(rewrite.from, value);
-  } else if (rewrites.count(rewrite.from)) {
-    // This rule is trying to rewrite the same variable as another rule
-    auto & overlap = rewrites[rewrite.from];
-    // Combine the two rewrite rule's negations
-    bool new_negated = (overlap.negated != rewrite.negated);
-    if (overlap.to < rewrite.to) {
-      // We want to use the original's "to"
-      TwoConsistency updated(rewrite.to, overlap.to, new_negated);
-      // Recurse on the new rule
-      return add(updated);
-    } else if (overlap.to > rewrite.to) {
-      // We want to use the new rule's "to"
-      TwoConsistency updated(overlap.to, rewrite.to, new_negated);
-      // Recurse on the new rule
-      return add(updated);
-    } else {
-      assert(rewrite.to == overlap.to and rewrite.from == overlap.from);
-      if (rewrite.negated != overlap.negated) {
-        // We have found two rewrite rules that contradict each other
-        is_unsat = true;
-      }
-      return {};
+    return;
+  }
+  nodes[root].value = root_value;
+  if (not checkpoints.empty()) {
+    trail.push_back({uint32_t(root), uint32_t(root), false, 0});
+  }
+  // Every other member of the class stops being a rewrite and becomes an assignment
+  total_rewrites -= nodes[root].size - 1;
+  size_t member = root;
+  do {
+    assigned_order.push_back(member);
+    if (updated) {
+      updated->insert(member);
     }
-  } else if (rewrites.count(rewrite.to)) {
-    // This rule writes to something that itself has a rewrite
-    // Assumes "from" is unique"
-    auto updated = rewrite;
-    auto & overlap = rewrites[rewrite.to];
-    // advance the "to"
-    updated.to = overlap.to;
-    if (overlap.negated) {
-      updated.negated = not updated.negated;
+    member = nodes[member].next;
+  } while (member != root);
+}
+
+void Knowledge::add(const TwoConsistency& rewrite, UpdatedVariables* updated) {
+  grow(rewrite.from);
+  grow(rewrite.to);
+  size_t from_root = nodes[rewrite.from].parent;
+  size_t to_root = nodes[rewrite.to].parent;
+  // The relationship this rule implies between the two roots
+  const bool negated = (rewrite.negated != nodes[rewrite.from].parity) != nodes[rewrite.to].parity;
+  if (from_root == to_root) {
+    if (negated) {
+      // This rule contradicts what is already known about the class
+      is_unsat = true;
     }
-    rewrites[updated.from] = updated;
-    sources[updated.to].push_back(updated.from);
-    return {updated.from};
-  } else {
-    unordered_set<size_t> has_been_updated;
-    // All other cases can be safely handled by this
-    // Rules that currently rewrite to "from" (if any), now need to write to "to"
-    for (const auto upstream : sources[rewrite.from]) {
-      auto& up = rewrites[upstream];
-      up.to = rewrite.to;
-      // If the new rule includes a negation, invert old rule's pattern
-      if (rewrite.negated) {
-        up.negated = not up.negated;
-      }
-      sources[rewrite.to].push_back(upstream);
-      // TODO figure out if this is actually needed
-      has_been_updated.insert(up.from);
+    return;
+  }
+  if (nodes[from_root].value != UNKNOWN) {
+    // "from" is already assigned, so assign "to" as well
+    add(rewrite.to, value(rewrite.from) != rewrite.negated, updated);
+    return;
+  }
+  if (nodes[to_root].value != UNKNOWN) {
+    // "to" is already assigned, so assign "from" as well
+    add(rewrite.from, value(rewrite.to) != rewrite.negated, updated);
+    return;
+  }
+  // Attach the smaller class to the larger one
+  size_t child = from_root, parent = to_root;
+  if (nodes[child].size > nodes[parent].size) {
+    std::swap(child, parent);
+  }
+  // Members of the class that loses its minimum now rewrite to a different variable
+  const size_t moved = nodes[from_root].minimum < nodes[to_root].minimum ? to_root : from_root;
+  size_t member = moved;
+  if (updated) {
+    do {
+      updated->insert(member);
+      member = nodes[member].next;
+    } while (member != moved);
+  }
+  for (const auto root : {child, parent}) {
+    if (nodes[root].size == 1) {
+      joined.push_back(root);
     }
-    // "from" is no longer downstream of anything
-    sources.erase(rewrite.from);
-    // Add the new rule itself
-    rewrites[rewrite.from] = rewrite;
-    sources[rewrite.to].push_back(rewrite.from);
-    has_been_updated.insert(rewrite.from);
-    return has_been_updated;
   }
+  if (not checkpoints.empty()) {
+    trail.push_back({uint32_t(child), uint32_t(parent), negated, nodes[parent].minimum});
+  }
+  // Point every member of "child" directly at "parent" so lookups never walk a path
+  member = child;
+  do {
+    nodes[member].parent = parent;
+    nodes[member].parity = nodes[member].parity != negated;
+    member = nodes[member].next;
+  } while (member != child);
+  // Splice the two circular lists together
+  std::swap(nodes[child].next, nodes[parent].next);
+  nodes[parent].size += nodes[child].size;
+  nodes[parent].minimum = std::min(nodes[parent].minimum, nodes[child].minimum);
+  total_rewrites++;
 }
 
-unordered_set<size_t> Knowledge::add(const Knowledge& knowledge) {
+void Knowledge::add(const Knowledge& knowledge, UpdatedVariables* updated) {
   is_sat |= knowledge.is_sat;
   is_unsat |= knowledge.is_unsat;
-  unordered_set<size_t> has_been_updated;
   // Add each assignment in "knowledge" to "*this"
-  for (const auto & assignment : knowledge.assigned) {
-    auto result = add(assignment.first, assignment.second);
-    has_been_updated.insert(result.begin(), result.end());
+  for (const auto variable : knowledge.assigned_order) {
+    add(variable, knowledge.value(variable), updated);
+  }
+  for (const auto variable : knowledge.joined) {
+    if (knowledge.is_rewritten(variable)) {
+      add(knowledge.rewrite(variable), updated);
+    }
+  }
+}
+
+vector<TwoConsistency> Knowledge::rewrites() const {
+  vector<TwoConsistency> result;
+  result.reserve(total_rewrites);
+  for (const auto variable : joined) {
+    if (is_rewritten(variable)) {
+      result.push_back(rewrite(variable));
+    }
   }
-  for (const auto & rewrite : knowledge.rewrites) {
-    auto result = add(rewrite.second);
-    has_been_updated.insert(result.begin(), result.end());
+  return result;
+}
+
+std::unordered_map<size_t, bool> Knowledge::assignments() const {
+  std::unordered_map<size_t, bool> result;
+  for (const auto variable : assigned_order) {
+    result[variable] = value(variable);
   }
-  return has_been_updated;
+  return result;
+}
+
+void Knowledge::checkpoint() {
+  checkpoints.push_back({trail.size(), assigned_order.size(), joined.size(), total_rewrites, is_sat, is_unsat});
+}
+
+void Knowledge::rollback() {
+  assert(not checkpoints.empty());
+  const auto& restore = checkpoints.back();
+  // Undo changes newest first, so each sees the classes as they were when it was made
+  while (trail.size() > restore.trail) {
+    const auto& change = trail.back();
+    if (change.child == change.parent) {
+      nodes[change.child].value = UNKNOWN;
+    } else {
+      // Swapping again splits the circular lists back apart
+      std::swap(nodes[change.child].next, nodes[change.parent].next);
+      size_t member = change.child;
+      do {
+        nodes[member].parent = change.child;
+        nodes[member].parity = nodes[member].parity != change.negated;
+        member = nodes[member].next;
+      } while (member != change.child);
+      nodes[change.parent].size -= nodes[change.child].size;
+      nodes[change.parent].minimum = change.minimum;
+    }
+    trail.pop_back();
+  }
+  assigned_order.resize(restore.assigned);
+  joined.resize(restore.joined);
+  total_rewrites = restore.rewrites;
+  is_sat = restore.is_sat;
+  is_unsat = restore.is_unsat;
+  checkpoints.pop_back();
+}
+
+size_t Knowledge::memory_bytes() const {
+  return vector_bytes(nodes) + vector_bytes(assigned_order) + vector_bytes(joined)
+      + vector_bytes(trail) + vector_bytes(checkpoints);
 }
 
 void Knowledge::print(std::ostream& out) const {
@@ -162,12 +190,12 @@ void Knowledge::print(std::ostream& out) const {
     out << "Proven UNSAT" << endl;
     return;
   }
-  out << "Assigned: " << assigned.size() << endl;
-  print_map(assigned, out);
-  out << "Two Consistencies: " << rewrites.size() << endl;
-  if (rewrites.size() > 0) {
-    for (const auto pair : rewrites) {
-      pair.second.print(out);
+  out << "Assigned: " << assigned_count() << endl;
+  print_map(assignments(), out);
+  out << "Two Consistencies: " << rewrite_count() << endl;
+  if (rewrite_count() > 0) {
+    for (const auto& rewrite : rewrites()) {
+      rewrite.print(out);
       out << ", ";
     }
     out << endl;
@@ -181,3 +209,24 @@ void TwoConsistency::print(std::ostream& out) const {
   }
   out << "=" << to;
 }
+
+void Knowledge::save(CheckpointWriter& out) const {
+  assert(checkpoints.empty());
+  out.write(is_sat);
+  out.write(is_unsat);
+  out.write_vector(nodes);
+  out.write_vector(assigned_order);
+  out.write_vector(joined);
+  out.write(total_rewrites);
+}
+
+void Knowledge::restore(CheckpointReader& in) {
+  is_sat = in.read();
+  is_unsat = in.read();
+  in.read_vector(nodes);
+  in.read_vector(assigned_order);
+  in.read_vector(joined);
+  total_rewrites = in.read();
+  trail.clear();
+  checkpoints.clear();
+}
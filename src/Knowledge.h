@@ -5,11 +5,12 @@
 #define KNOWLEDGE_H_
 #include <unordered_map>
 #include <vector>
+#include <cstdint>
 using std::vector;
 #include <cassert>
 #include <iostream>
-#include <unordered_set>
-using std::unordered_set;
+
+#include "MemoryUsage.h"
 
 struct TwoConsistency {
   size_t from, to;
@@ -23,25 +24,155 @@ struct TwoConsistency {
   void print(std::ostream& out=std::cout) const;
 };
 
-// TODO Make some of these things private to better track modifications
+// Collects the variables changed by "Knowledge::add", listing each once.
+// Callers keep one and "clear" it between uses, so adding allocates nothing
+// once it has grown. A variable is listed if its stamp matches the current
+// epoch, which makes clearing constant time.
+class UpdatedVariables {
+ public:
+  void clear() {
+    list.clear();
+    if (++epoch == 0) {
+      // Every stamp could now look current, so start over
+      stamps.assign(stamps.size(), 0);
+      epoch = 1;
+    }
+  }
+  void insert(size_t variable) {
+    if (variable >= stamps.size()) {
+      stamps.resize(variable + 1, 0);
+    }
+    if (stamps[variable] != epoch) {
+      stamps[variable] = epoch;
+      list.push_back(variable);
+    }
+  }
+  // In the order they were first inserted
+  vector<size_t>::const_iterator begin() const {
+    return list.begin();
+  }
+  vector<size_t>::const_iterator end() const {
+    return list.end();
+  }
+  size_t size() const {
+    return list.size();
+  }
+  bool empty() const {
+    return list.empty();
+  }
+  size_t memory_bytes() const {
+    return vector_bytes(list) + vector_bytes(stamps);
+  }
+ private:
+  vector<size_t> list;
+  vector<uint32_t> stamps;
+  uint32_t epoch = 1;
+};
+
+class CheckpointWriter;
+class CheckpointReader;
+
+// Variables are stored densely by index. Each variable belongs to a class of
+// variables that are all equal or opposite, tracked with a union-find where every
+// member points directly at its class's root along with its parity (whether it is
+// the opposite of the root). Assigning any member assigns the whole class.
 class Knowledge {
  public:
   bool is_sat = false;
   bool is_unsat = false;
-  std::unordered_map<size_t, bool> assigned;
-  std::unordered_map<size_t, TwoConsistency> rewrites;
 
-  // These functions add knowledge and return all variables affected by that new knowledge
-  unordered_set<size_t> add(const size_t variable, const bool value);
-  unordered_set<size_t> add(const TwoConsistency& rewrite);
-  unordered_set<size_t> add(const Knowledge& knowledge);
+  // These functions add knowledge, and if given "updated" insert into it every
+  // variable whose assignment or rewrite that new knowledge changed
+  void add(const size_t variable, const bool value, UpdatedVariables* updated=nullptr);
+  void add(const TwoConsistency& rewrite, UpdatedVariables* updated=nullptr);
+  void add(const Knowledge& knowledge, UpdatedVariables* updated=nullptr);
   bool empty() const {
-    return (not is_sat) and (not is_unsat) and assigned.empty() and rewrites.empty();
+    return (not is_sat) and (not is_unsat) and assigned_order.empty() and total_rewrites == 0;
+  }
+  bool is_assigned(const size_t variable) const {
+    return variable < nodes.size() and nodes[nodes[variable].parent].value != UNKNOWN;
+  }
+  // The value of an assigned variable
+  bool value(const size_t variable) const {
+    assert(is_assigned(variable));
+    const auto& node = nodes[variable];
+    return nodes[node.parent].value != node.parity;
+  }
+  // True if "variable" is unassigned and equal (or opposite) to a smaller variable
+  bool is_rewritten(const size_t variable) const {
+    if (variable >= nodes.size()) {
+      return false;
+    }
+    const auto& root = nodes[nodes[variable].parent];
+    return root.value == UNKNOWN and root.minimum != variable;
   }
+  // The rule which rewrites "variable" to the smallest variable in its class
+  TwoConsistency rewrite(const size_t variable) const {
+    assert(is_rewritten(variable));
+    const auto& node = nodes[variable];
+    const size_t to = nodes[node.parent].minimum;
+    return TwoConsistency(variable, to, node.parity != nodes[to].parity);
+  }
+  size_t assigned_count() const {
+    return assigned_order.size();
+  }
+  size_t rewrite_count() const {
+    return total_rewrites;
+  }
+  // Every assigned variable, in the order they were assigned
+  const vector<size_t>& assigned_variables() const {
+    return assigned_order;
+  }
+  vector<TwoConsistency> rewrites() const;
+  std::unordered_map<size_t, bool> assignments() const;
   void print(std::ostream& out=std::cout) const;
+  // Heap memory held by this knowledge
+  size_t memory_bytes() const;
+
+  // Starts recording changes so they can be undone. Checkpoints can be nested.
+  void checkpoint();
+  // Undoes every change made since the most recent "checkpoint"
+  void rollback();
+  // Only allowed when there are no checkpoints
+  void save(CheckpointWriter& out) const;
+  void restore(CheckpointReader& in);
  private:
-  // Used to quickly update rewrites when new knowledge is added
-  std::unordered_map<size_t, std::vector<size_t>> sources;
+  static const signed char UNKNOWN = -1;
+  struct Node {
+    // Variable indices are stored in 32 bits to keep nodes small
+    uint32_t parent;
+    // Next member of this variable's class, forming a circular list
+    uint32_t next;
+    // Only meaningful on roots
+    uint32_t size = 1;
+    uint32_t minimum;
+    // If this variable is the opposite of its root
+    bool parity = false;
+    // Only meaningful on roots: UNKNOWN, 0 or 1
+    signed char value = UNKNOWN;
+  };
+  vector<Node> nodes;
+  vector<size_t> assigned_order;
+  // Every variable that has been in a class with another variable
+  vector<size_t> joined;
+  size_t total_rewrites = 0;
+  // Ensures "variable" has a node
+  void grow(const size_t variable);
+
+  // A root being assigned (child == parent) or "child" being attached to "parent"
+  struct Change {
+    uint32_t child, parent;
+    bool negated;
+    // The parent's minimum before the change
+    uint32_t minimum;
+  };
+  // Only recorded while there is a checkpoint
+  vector<Change> trail;
+  struct Checkpoint {
+    size_t trail, assigned, joined, rewrites;
+    bool is_sat, is_unsat;
+  };
+  vector<Checkpoint> checkpoints;
 };
 
 
@@ -0,0 +1,108 @@
+#include "Log.h"
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+using std::vector;
+
+LogLevel Log::verbosity = LOG_INFO;
+
+const char* const LEVEL_NAMES[] = {"error", "warning", "info", "debug", "trace"};
+
+// Owns the thread that writes queued lines. Being a function static, it is
+// destroyed at exit, which writes anything still queued.
+class LogWriter {
+ public:
+  LogWriter() : writer([this] { run(); }) {
+  }
+  ~LogWriter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    writer.join();
+  }
+  void push(string&& text) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending.push_back(std::move(text));
+      queued++;
+    }
+    wake.notify_all();
+  }
+  void flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    const size_t target = queued;
+    done.wait(lock, [&] { return written >= target; });
+  }
+ private:
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  vector<string> pending;
+  size_t queued = 0, written = 0;
+  bool stopping = false;
+  std::thread writer;
+
+  void run() {
+    vector<string> writing;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wake.wait(lock, [&] { return stopping or not pending.empty(); });
+      if (pending.empty()) {
+        return;
+      }
+      // Write everything queued at once, without holding up new lines
+      writing.swap(pending);
+      lock.unlock();
+      for (const auto& text : writing) {
+        fwrite(text.data(), 1, text.size(), stderr);
+      }
+      fflush(stderr);
+      lock.lock();
+      written += writing.size();
+      writing.clear();
+      done.notify_all();
+    }
+  }
+};
+
+LogWriter& log_writer() {
+  static LogWriter writer;
+  return writer;
+}
+
+LogLevel Log::parse_level(const string& name) {
+  for (size_t level=LOG_ERROR; level <= LOG_TRACE; level++) {
+    if (name == LEVEL_NAMES[level]) {
+      return LogLevel(level);
+    }
+  }
+  throw std::invalid_argument("Unknown log level '" + name + "'");
+}
+
+void Log::flush() {
+  log_writer().flush();
+}
+
+void Log::write(string&& text) {
+  log_writer().push(std::move(text));
+}
+
+LogLine::LogLine(LogLevel level) {
+  if (level == LOG_ERROR) {
+    buffer << "Error: ";
+  } else if (level == LOG_WARNING) {
+    buffer << "Warning: ";
+  }
+}
+
+LogLine::~LogLine() {
+  string text = buffer.str();
+  if (text.empty() or text.back() != '\n') {
+    text.push_back('\n');
+  }
+  Log::write(std::move(text));
+}
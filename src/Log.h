@@ -0,0 +1,64 @@
+// Leveled logging, written to stderr by a background thread so the solver
+// never waits on output. Statements more detailed than LOG_COMPILED_LEVEL are
+// removed at compile time, and those more detailed than the runtime level
+// cost one comparison. In both cases the message is never built.
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <sstream>
+#include <string>
+using std::string;
+
+// Each level includes everything above it
+enum LogLevel {
+  LOG_ERROR,
+  LOG_WARNING,
+  // Progress through the phases of the solver
+  LOG_INFO,
+  // Once per function processed or merge performed
+  LOG_DEBUG,
+  // Inside the conversion of learned rows
+  LOG_TRACE
+};
+
+// Compile with -DLOG_COMPILED_LEVEL=LOG_INFO (for example) to remove more detailed statements
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_TRACE
+#endif
+
+class Log {
+ public:
+  static bool enabled(LogLevel level) {
+    return level <= LOG_COMPILED_LEVEL and level <= verbosity;
+  }
+  static void set_level(LogLevel level) {
+    verbosity = level;
+  }
+  // Converts a name such as "debug" into its level
+  static LogLevel parse_level(const string& name);
+  // Waits until everything logged so far has been written
+  static void flush();
+
+ private:
+  static LogLevel verbosity;
+  static void write(string&& text);
+  friend class LogLine;
+};
+
+// Collects one message, which is queued for writing when the line is destroyed
+class LogLine {
+ public:
+  explicit LogLine(LogLevel level);
+  ~LogLine();
+  std::ostream& stream() {
+    return buffer;
+  }
+ private:
+  std::ostringstream buffer;
+};
+
+// Usage: LOG(LOG_INFO) << "Merged " << rows;
+// Nothing after LOG(...) is evaluated unless the level is enabled.
+#define LOG(level) if (not Log::enabled(level)) {} else LogLine(level).stream()
+
+#endif /* LOG_H_ */
@@ -0,0 +1,219 @@
+#include "MappedFile.h"
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& filename) {
+  const int descriptor = open(filename.c_str(), O_RDONLY);
+  if (descriptor < 0) {
+    throw std::system_error(errno, std::generic_category(), "Unable to open '" + filename + "'");
+  }
+  struct stat status;
+  if (fstat(descriptor, &status) != 0) {
+    const int error = errno;
+    close(descriptor);
+    throw std::system_error(error, std::generic_category(), "Unable to stat '" + filename + "'");
+  }
+  length = status.st_size;
+  // Mapping zero bytes fails, and an empty file needs no mapping anyway
+  if (length > 0) {
+    void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    if (mapped == MAP_FAILED) {
+      const int error = errno;
+      close(descriptor);
+      throw std::system_error(error, std::generic_category(), "Unable to map '" + filename + "'");
+    }
+    // The file is read front to back exactly once
+    madvise(mapped, length, MADV_SEQUENTIAL);
+    data = static_cast<const char*>(mapped);
+  }
+  // The mapping stays valid after the descriptor is closed
+  close(descriptor);
+}
+
+MappedFile::~MappedFile() {
+  if (data != nullptr) {
+    munmap(const_cast<char*>(data), length);
+  }
+}
+
+Scanner::Scanner(const char* begin, const char* end, const std::string& name_, size_t first_line)
+    : position(begin), finish(end), name(name_), line_number(first_line) {
+}
+
+void Scanner::error(const std::string& message) const {
+  throw std::invalid_argument(name + ":" + std::to_string(line_number) + ": " + message);
+}
+
+void Scanner::skip_blanks() {
+  while (position != finish and (*position == ' ' or *position == '\t' or *position == '\r')) {
+    position++;
+  }
+}
+
+bool Scanner::at_line_end() {
+  skip_blanks();
+  return position == finish or *position == '\n';
+}
+
+void Scanner::next_line() {
+  const char* found = static_cast<const char*>(memchr(position, '\n', finish - position));
+  if (found == nullptr) {
+    position = finish;
+  } else {
+    position = found + 1;
+    line_number++;
+  }
+}
+
+char Scanner::peek() {
+  if (at_line_end()) {
+    return '\n';
+  }
+  return *position;
+}
+
+const char* Scanner::word_end() const {
+  // A comma is a word of its own, so "5," reads as "5" followed by ","
+  if (position != finish and *position == ',') {
+    return position + 1;
+  }
+  const char* end = position;
+  while (end != finish and *end != ' ' and *end != '\t' and *end != '\r' and *end != '\n' and *end != ',') {
+    end++;
+  }
+  return end;
+}
+
+void Scanner::expect(const char* expected) {
+  if (at_line_end()) {
+    error(std::string("expected '") + expected + "' but the line ended");
+  }
+  const char* end = word_end();
+  const size_t length = strlen(expected);
+  if (size_t(end - position) != length or memcmp(position, expected, length) != 0) {
+    error(std::string("expected '") + expected + "' but found '" + std::string(position, end) + "'");
+  }
+  position = end;
+}
+
+size_t Scanner::read_unsigned() {
+  if (at_line_end()) {
+    error("expected a number but the line ended");
+  }
+  const char* end = word_end();
+  size_t result = 0;
+  for (const char* p = position; p != end; p++) {
+    if (*p < '0' or *p > '9') {
+      error("expected a number but found '" + std::string(position, end) + "'");
+    }
+    const size_t digit = *p - '0';
+    if (result > (SIZE_MAX - digit) / 10) {
+      error("number '" + std::string(position, end) + "' is too large");
+    }
+    result = result * 10 + digit;
+  }
+  position = end;
+  return result;
+}
+
+int64_t Scanner::read_integer() {
+  if (peek() != '-') {
+    const char* start = position;
+    const size_t value = read_unsigned();
+    if (value > size_t(INT64_MAX)) {
+      position = start;
+      error("number '" + std::string(start, word_end()) + "' is too large");
+    }
+    return value;
+  }
+  const char* start = position;
+  position++;
+  if (at_end() or *position < '0' or *position > '9') {
+    position = start;
+    error("expected a number but found '" + std::string(start, word_end()) + "'");
+  }
+  const size_t magnitude = read_unsigned();
+  if (magnitude > size_t(INT64_MAX)) {
+    error("number '" + std::string(start, position) + "' is too large");
+  }
+  return -int64_t(magnitude);
+}
+
+// Wide enough to hold a word times a word plus a word
+__extension__ typedef unsigned __int128 double_word;
+
+// Value of a hexadecimal digit, or -1 if "c" is not one
+int hex_value(char c) {
+  if (c >= '0' and c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' and c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' and c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+std::vector<uint64_t> Scanner::read_big_integer() {
+  if (at_line_end()) {
+    error("expected an integer but the line ended");
+  }
+  const char* end = word_end();
+  const char* digits = position;
+  std::vector<uint64_t> result;
+  if (end - digits > 2 and digits[0] == '0' and (digits[1] == 'x' or digits[1] == 'X')) {
+    digits += 2;
+    // Each word is 16 hex digits, starting from the least significant end
+    for (const char* word_stop = end; word_stop > digits; word_stop -= 16) {
+      const char* word_start = word_stop - digits > 16 ? word_stop - 16 : digits;
+      uint64_t word = 0;
+      for (const char* p = word_start; p != word_stop; p++) {
+        const int value = hex_value(*p);
+        if (value < 0) {
+          error("bad hexadecimal integer '" + std::string(position, end) + "'");
+        }
+        word = (word << 4) | value;
+      }
+      result.push_back(word);
+    }
+  } else {
+    // Work through 19 digits at a time, as 10^19 is the largest power of 10 in a word
+    const size_t CHUNK = 19;
+    const char* chunk_start = digits;
+    const size_t first_chunk = (end - digits) % CHUNK;
+    const char* chunk_stop = digits + (first_chunk == 0 ? CHUNK : first_chunk);
+    for (; chunk_start != end; chunk_start = chunk_stop, chunk_stop += CHUNK) {
+      uint64_t chunk = 0, scale = 1;
+      for (const char* p = chunk_start; p != chunk_stop; p++) {
+        if (*p < '0' or *p > '9') {
+          error("bad integer '" + std::string(position, end) + "'");
+        }
+        chunk = chunk * 10 + (*p - '0');
+        scale *= 10;
+      }
+      // result = result * scale + chunk
+      double_word carry = chunk;
+      for (auto& word : result) {
+        carry += static_cast<double_word>(word) * scale;
+        word = static_cast<uint64_t>(carry);
+        carry >>= 64;
+      }
+      if (carry != 0) {
+        result.push_back(static_cast<uint64_t>(carry));
+      }
+    }
+  }
+  while (not result.empty() and result.back() == 0) {
+    result.pop_back();
+  }
+  position = end;
+  return result;
+}
@@ -0,0 +1,74 @@
+// Read-only access to a whole file through mmap, and a scanner that parses
+// numbers directly from the mapped bytes. Words are separated by blanks, and a
+// comma is always a word of its own. Parse errors are thrown as
+// std::invalid_argument naming the file and line.
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+using std::size_t;
+
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  const char* begin() const {
+    return data;
+  }
+  const char* end() const {
+    return data + length;
+  }
+  size_t size() const {
+    return length;
+  }
+ private:
+  const char* data = nullptr;
+  size_t length = 0;
+};
+
+class Scanner {
+ public:
+  // "first_line" is the line number of "begin", used in error messages
+  Scanner(const char* begin, const char* end, const std::string& name, size_t first_line=1);
+  bool at_end() const {
+    return position == finish;
+  }
+  const char* current() const {
+    return position;
+  }
+  // Skips spaces and tabs, but not line breaks
+  void skip_blanks();
+  // True if only blanks remain on this line
+  bool at_line_end();
+  // Moves to the start of the next line, skipping whatever is left of this one
+  void next_line();
+  // The next character on this line after any blanks, or '\n' if there are none
+  char peek();
+  // Requires that the next word is exactly "expected"
+  void expect(const char* expected);
+  size_t read_unsigned();
+  // Reads an integer with an optional leading '-'
+  int64_t read_integer();
+  // Reads a non-negative integer of any size, in decimal or with a "0x" prefix for
+  // hexadecimal, as 64-bit words with the least significant first
+  std::vector<uint64_t> read_big_integer();
+  size_t line() const {
+    return line_number;
+  }
+  // Throws an error about the current line
+  [[noreturn]] void error(const std::string& message) const;
+ private:
+  const char* position;
+  const char* finish;
+  std::string name;
+  size_t line_number;
+  // The end of the word starting at "position"
+  const char* word_end() const;
+};
+
+#endif /* MAPPEDFILE_H_ */
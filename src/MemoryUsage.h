@@ -0,0 +1,21 @@
+// Estimates of the heap memory held by standard containers, counted from their
+// capacity rather than their size since that is what is actually allocated.
+#ifndef MEMORYUSAGE_H_
+#define MEMORYUSAGE_H_
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+template <class T>
+size_t vector_bytes(const std::vector<T>& v) {
+  return v.capacity() * sizeof(T);
+}
+
+// The bucket array plus one node per element, each with a next pointer and a cached hash
+template <class Map>
+size_t hash_table_bytes(const Map& m) {
+  return m.bucket_count() * sizeof(void*) + m.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*));
+}
+
+#endif /* MEMORYUSAGE_H_ */
@@ -6,27 +6,47 @@
  */
 
 #include "Problem.h"
-#include <fstream>
-using std::ifstream;
-#include <sstream>
-using std::istringstream;
+#include "ThreadPool.h"
+#include "MappedFile.h"
+#include "CNF.h"
+#include "Checkpoint.h"
+#include "Log.h"
+#include "Statistics.h"
 #include <cassert>
 using std::unordered_map;
+using std::unordered_set;
 #include <map>
 using std::map;
-
-using std::cout;
-using std::endl;
+#include <set>
+#include <algorithm>
 
 #include <math.h>
 
-void Problem::load(const string& filename) {
-  // clear out the old problem
+// When propagating with several threads, how many DNFs each thread processes per batch
+const size_t PROPAGATE_BATCH_PER_THREAD = 8;
+// When testing each row of a DNF, how many rows each thread tests per batch
+const size_t ASSUME_BATCH_PER_THREAD = 256;
+// How many of the first DNFs in "merge_order" "heuristic_merge" tries to merge
+const size_t MERGE_FIRST_CANDIDATES = 4;
+// How many DNFs sharing variables with each of those it considers as partners
+const size_t MERGE_PARTNER_CANDIDATES = 16;
+
+void Problem::clear() {
   dnfs.clear();
   variable_to_dnfs.clear();
+  scopes.clear();
   requires_knowledge_propagate.clear();
   requires_assume_and_learn.clear();
+  merge_order.clear();
   global_knowledge = Knowledge();
+  // Contexts remember row masks by handle, and handles are about to be reused
+  assumptions.clear();
+}
+
+void Problem::load(const string& filename) {
+  PhaseTimer timer(LOAD_PHASE);
+  // clear out the old problem
+  clear();
 
   // find the file extension
   size_t dot_position = filename.rfind(".");
@@ -34,9 +54,10 @@ void Problem::load(const string& filename) {
     throw std::invalid_argument("Problem file '" + filename + "' missing extension");
   }
   string extension = filename.substr(dot_position + 1);
-  // TODO Write a loading method for cnf form
   if (extension == "dnf") {
     load_dnf(filename);
+  } else if (extension == "cnf") {
+    load_cnf(filename);
   } else {
     throw std::invalid_argument("Bad problem file extension: '" + extension + "'");
   }
@@ -45,64 +66,135 @@ void Problem::load(const string& filename) {
 }
 
 void Problem::load_dnf(const string& filename) {
-  ifstream in(filename);
-  string line, word;
+  MappedFile file(filename);
+  Scanner in(file.begin(), file.end(), filename);
   // Process the header
-  getline(in, line);
-  istringstream iss(line);
-  iss >> word;
-  assert(word == "p");
-  iss >> word;
-  assert(word == "dnf");
-  size_t total_dnfs;
-  iss >> total_variables >> total_dnfs;
+  in.expect("p");
+  in.expect("dnf");
+  total_variables = in.read_unsigned();
+  const size_t total_dnfs = in.read_unsigned();
+  if (not in.at_line_end()) {
+    in.error("unexpected text after the header");
+  }
   variable_to_dnfs.resize(total_variables + 1);
   // Ignore the second line
-  getline(in, line);
-  vector<vector<bool>> table;
-
-  while (getline(in, line)) {
-    istringstream iss(line);
-    // If you are starting a new pattern, extract the table
-    if (line[0] == '*') {
-      table.clear();
-      // Throw away the "******* Big integer:"
-      iss >> word >> word >> word;
-      uint64_t big_int;
-      iss >> big_int;
-      // Throw away the ", Block size = "
-      iss >> word >> word >> word >> word;
-      size_t number_of_variables;
-      iss >> number_of_variables;
-
-      // While there are set bits in the big integer
-      for (size_t position = 0; big_int; position++, big_int>>=1) {
-        // If the big integer has a 0 at this position, skip it
-        if ((big_int & 1) == 0) {
-          continue;
-        }
-        // Add a row to the table
-        table.emplace_back(number_of_variables);
-        for (size_t i=0; i < number_of_variables; i++) {
-          // Finds the bit value of "position" at i
-          table.back()[i] = ((position >> i) & 1);
-        }
+  in.next_line();
+  in.next_line();
+
+  size_t blocks = 0;
+  vector<size_t> variables;
+  while (not in.at_end()) {
+    if (in.at_line_end()) {
+      in.next_line();
+      continue;
+    }
+    // Each block is a "******* Big integer: X , Block size = K" line followed by K variables
+    in.expect("*******");
+    in.expect("Big");
+    in.expect("integer:");
+    const auto big_int = in.read_big_integer();
+    in.expect(",");
+    in.expect("Block");
+    in.expect("size");
+    in.expect("=");
+    const size_t number_of_variables = in.read_unsigned();
+    if (number_of_variables > MAX_BLOCK_SIZE) {
+      in.error("block size " + std::to_string(number_of_variables) + " is larger than "
+               + std::to_string(MAX_BLOCK_SIZE));
+    }
+    // Every set bit must be a position in a table of 2^K rows
+    if (not big_int.empty()) {
+      const size_t highest_bit = big_int.size() * 64 - __builtin_clzll(big_int.back());
+      if (highest_bit > (size_t(1) << number_of_variables)) {
+        in.error("big integer has more than 2^" + std::to_string(number_of_variables) + " bits");
       }
-    } else {
-      // Build up the variables to go with the table
-      vector<size_t> variables;
-      size_t variable;
-      while (iss >> variable) {
-        assert(0 < variable);
-        assert(variable <= total_variables);
-        variables.push_back(variable);
+    }
+    in.next_line();
+    if (in.at_end()) {
+      in.error("block is missing its variables");
+    }
+    // Build up the variables to go with the table
+    variables.clear();
+    while (not in.at_line_end()) {
+      const size_t variable = in.read_unsigned();
+      if (variable == 0 or variable > total_variables) {
+        in.error("variable " + std::to_string(variable) + " is not in 1.." + std::to_string(total_variables));
       }
-      // The number of variables should be equal to the columns in the table
-      assert(variables.size() == table[0].size());
-      add_dnf(std::make_shared<DNF>(variables, table));
+      variables.push_back(variable);
+    }
+    // The number of variables should be equal to the columns in the table
+    if (variables.size() != number_of_variables) {
+      in.error("expected " + std::to_string(number_of_variables) + " variables but found "
+               + std::to_string(variables.size()));
+    }
+    in.next_line();
+    intern(add_dnf(DNF(variables, big_int)));
+    blocks++;
+  }
+  if (blocks != total_dnfs) {
+    in.error("header promised " + std::to_string(total_dnfs) + " blocks but found " + std::to_string(blocks));
+  }
+}
+
+void Problem::load_cnf(const string& filename) {
+  auto functions = read_cnf(filename, CNF_GROUP_LIMIT, total_variables);
+  variable_to_dnfs.resize(total_variables + 1);
+  for (auto& dnf : functions) {
+    intern(add_dnf(std::move(dnf)));
+  }
+}
+
+void Problem::save_checkpoint(const string& filename) const {
+  PhaseTimer timer(CHECKPOINT_PHASE);
+  CheckpointWriter out(filename);
+  out.write(total_variables);
+  dnfs.save(out);
+  out.write(variable_to_dnfs.size());
+  for (const auto& bin : variable_to_dnfs) {
+    out.write_vector(bin);
+  }
+  requires_knowledge_propagate.save(out);
+  // Both heaps are saved in heap order so pushing them back recreates the same layout
+  out.write_vector(requires_assume_and_learn.handles());
+  out.write_vector(merge_order.handles());
+  global_knowledge.save(out);
+  out.finish();
+}
+
+void Problem::load_checkpoint(const string& filename) {
+  PhaseTimer timer(CHECKPOINT_PHASE);
+  clear();
+  CheckpointReader in(filename);
+  total_variables = in.read();
+  dnfs.restore(in);
+  variable_to_dnfs.resize(in.read());
+  for (auto& bin : variable_to_dnfs) {
+    in.read_vector(bin);
+  }
+  for (const auto handle : dnfs.live()) {
+    scopes.set(handle, dnfs[handle].get_variables());
+  }
+  requires_knowledge_propagate.restore(in);
+  vector<dnf_handle> handles;
+  in.read_vector(handles);
+  for (const auto handle : handles) {
+    if (not dnfs.contains(handle)) {
+      in.error("assume-and-learn queue refers to a missing function");
     }
+    require_assume_and_learn(handle);
   }
-  assert(total_dnfs == dnfs.size());
+  in.read_vector(handles);
+  for (const auto handle : handles) {
+    if (not dnfs.contains(handle)) {
+      in.error("merge order refers to a missing function");
+    }
+    merge_order.push(handle, merge_key(dnfs[handle]));
+  }
+  global_knowledge.restore(in);
+  if (not in.at_end()) {
+    in.error("unexpected data after the problem");
+  }
+  sanity_check();
 }
 
 void Problem::print(std::ostream& out) const {
@@ -110,162 +202,286 @@ void Problem::print(std::ostream& out) const {
     out << "(Empy Problem)" << std::endl;
     return;
   }
-  for (const auto& dnf : dnfs) {
-    dnf->print(out);
+  for (const auto handle : dnfs.live()) {
+    dnfs[handle].print(out);
   }
 }
 void Problem::print_short(std::ostream& out) const {
   out << "Variables: " << total_variables
-      << " Assigned: " << global_knowledge.assigned.size()
-      << " Rewritten: " << global_knowledge.rewrites.size()
+      << " Assigned: " << global_knowledge.assigned_count()
+      << " Rewritten: " << global_knowledge.rewrite_count()
       << " Functions: " << dnfs.size();
   size_t total_rows = 0;
-  for (const auto dnf : dnfs) {
-    total_rows += dnf->get_table().size();
+  for (const auto handle : dnfs.live()) {
+    total_rows += dnfs[handle].total_rows();
   }
   out << " Rows: " << total_rows << std::endl;
 }
 
-void Problem::knowledge_propagate() {
-  // Redirects to the private function saying we want to add to the global knowledge
-  // and we want to modify the problem using what we learn
-  knowledge_propagate(global_knowledge, true);
+void Problem::log_short(LogLevel level) const {
+  // Totaling the rows visits every function, so only do it if it will be seen
+  if (Log::enabled(level)) {
+    LogLine line(level);
+    print_short(line.stream());
+  }
 }
 
-void Problem::propagate_assumption(Knowledge& assumption) {
-  // We need to add all variables in the assumption to "requires_knowledge_propagation"
-  for (const auto& pair : assumption.assigned) {
-    auto& overlapping_dnfs = variable_to_dnfs[pair.first];
-    requires_knowledge_propagate.insert(overlapping_dnfs.begin(), overlapping_dnfs.end());
+// Counts knowledge the problem has learned from one of its functions
+void count_learned(const Knowledge& learned) {
+  if (not learned.is_unsat) {
+    Statistics::add(KNOWLEDGE_CREATED);
+    Statistics::add(FACTS_LEARNED, learned.assigned_count() + learned.rewrite_count());
   }
-  // Add all dnfs that overlap a 2-consistency to the open_set
-  for (const auto& pair : assumption.rewrites) {
-    // TODO technically when not modifying in place, you only need to propagate functions
-    // that have both the "from" and the "to" of a 2-consistency.
-    auto& overlapping_dnfs = variable_to_dnfs[pair.first];
-    requires_knowledge_propagate.insert(overlapping_dnfs.begin(), overlapping_dnfs.end());
+}
+
+// What processing a DNF would produce using the knowledge at the start of its batch
+struct Speculation {
+  // If applying the knowledge changed the DNF, in which case "dnf" is the changed copy
+  bool change_made = false;
+  DNF dnf;
+  Knowledge learned;
+};
+
+// Applies "knowledge" to a copy of "original" (only if it would change) and learns from the result
+void speculate(const DNF& original, const Knowledge& knowledge, Speculation& result) {
+  const auto& variables = original.get_variables();
+  bool affected = false;
+  for (const auto v : variables) {
+    if (knowledge.is_assigned(v) or knowledge.is_rewritten(v)) {
+      affected = true;
+      break;
+    }
+  }
+  if (not affected) {
+    result.change_made = false;
+    result.learned = original.create_knowledge();
+    return;
   }
-  knowledge_propagate(assumption, false);
+  result.dnf = original;
+  result.change_made = result.dnf.apply_knowledge(knowledge);
+  result.learned = result.dnf.create_knowledge();
 }
 
-void Problem::knowledge_propagate(Knowledge& knowledge, bool modify_in_place) {
+void Problem::knowledge_propagate() {
+  PhaseTimer timer(KNOWLEDGE_PROPAGATE_PHASE);
+  // Everything learned is added to the global knowledge and used to modify the problem.
+  // With more than one thread, each batch of DNFs is first processed in parallel against
+  // the knowledge at the start of the batch. Results are then committed in the same order
+  // as the serial loop, redoing any DNF that uses a variable the batch already updated,
+  // so the outcome is identical for any number of threads.
+  auto& pool = ThreadPool::global();
+  const size_t batch_size = pool.size() > 1 ? PROPAGATE_BATCH_PER_THREAD * pool.size() : 0;
+  vector<Speculation> speculations;
+  // The batch in which each variable was last updated
+  vector<size_t> updated_in_batch;
+  size_t batch = 0;
+  if (batch_size > 0) {
+    updated_in_batch.assign(variable_to_dnfs.size(), 0);
+  }
   while (not requires_knowledge_propagate.empty()) {
     // Dump everything into a buffer so that you process everything once before repeating anything
-    vector<std::weak_ptr<DNF>> buffer(requires_knowledge_propagate.begin(), requires_knowledge_propagate.end());
+    vector<dnf_handle> buffer(requires_knowledge_propagate.begin(), requires_knowledge_propagate.end());
     requires_knowledge_propagate.clear();
+    Statistics::add(PROPAGATION_ROUNDS);
+    // Speculations cover buffer positions [batch_begin, buffer.size()) of the current batch
+    size_t batch_begin = buffer.size();
     while (buffer.size() > 0) {
-      auto weak_dnf = buffer.back();
+      if (batch_size > 0 and buffer.size() == batch_begin) {
+        // Start a new batch with the DNFs at the back of the buffer
+        batch_begin = buffer.size() > batch_size ? buffer.size() - batch_size : 0;
+        batch++;
+        speculations.resize(buffer.size() - batch_begin);
+        pool.parallel_for(speculations.size(), [&](size_t i) {
+          const auto handle = buffer[batch_begin + i];
+          if (dnfs.contains(handle)) {
+            speculate(dnfs[handle], global_knowledge, speculations[i]);
+          }
+        });
+      }
+      auto handle = buffer.back();
       buffer.pop_back();
-      if (not weak_dnf.lock()) {
-        // TODO REMOVE THIS
+      if (not dnfs.contains(handle)) {
+        // Removed since it was added to the buffer
         continue;
       }
-      if (modify_in_place) {
-        //weak_dnf = resolve_overlaps(weak_dnf);
-      }
-      auto realized_dnf = weak_dnf.lock();
-      assert(realized_dnf);
-      if (not modify_in_place) {
-        // Makes a copy
-        realized_dnf = std::make_shared<DNF>(*realized_dnf);
-      }
+      Statistics::add(DNFS_VISITED);
+      auto& realized_dnf = dnfs[handle];
+      const size_t rows_before = realized_dnf.total_rows();
       // Apply the current knowledge to this dnf
       bool change_made = false;
-      change_made |= realized_dnf->apply_knowledge(knowledge);
-      // Learn from the (potentially changed) dnf
-      auto learned = realized_dnf->create_knowledge();
+      Knowledge learned;
+      bool speculated = batch_size > 0;
+      if (speculated) {
+        // Only valid if nothing this DNF uses has been updated since the batch started
+        for (const auto v : realized_dnf.get_variables()) {
+          if (updated_in_batch[v] == batch) {
+            speculated = false;
+            break;
+          }
+        }
+      }
+      if (speculated) {
+        auto& speculation = speculations[buffer.size() - batch_begin];
+        if (speculation.change_made) {
+          realized_dnf = std::move(speculation.dnf);
+          change_made = true;
+        }
+        learned = std::move(speculation.learned);
+      } else {
+        change_made |= realized_dnf.apply_knowledge(global_knowledge);
+        // Learn from the (potentially changed) dnf
+        learned = realized_dnf.create_knowledge();
+      }
+      count_learned(learned);
       if (not learned.empty()) {
-        auto require_updating = knowledge.add(learned);
-        if (knowledge.is_unsat) {
+        updated.clear();
+        global_knowledge.add(learned, &updated);
+        if (global_knowledge.is_unsat) {
           // Do not go further, just return what made you UNSAT
           return;
         }
         // Open up affected DNFs
-        for (const auto v : require_updating) {
-          // TODO Technically if you aren't modify_in_place, you don't need to reopen everything
-          requires_knowledge_propagate.insert(variable_to_dnfs[v].begin(), variable_to_dnfs[v].end());
-        }
-        if (modify_in_place) {
-          // This updates "variable_to_dnf"
-          clean_up_bins(require_updating);
+        for (const auto v : updated) {
+          open_variable(requires_knowledge_propagate, v);
+          if (batch_size > 0) {
+            updated_in_batch[v] = batch;
+          }
         }
+        // This updates "variable_to_dnf"
+        clean_up_bins(updated);
         // This removes some columns of the dnf now that we know their knowledge
-        change_made |= realized_dnf->apply_knowledge(knowledge);
+        change_made |= realized_dnf.apply_knowledge(global_knowledge);
       }
-      if (change_made and modify_in_place) {
+      Statistics::add(ROWS_REMOVED, rows_before - realized_dnf.total_rows());
+      if (change_made) {
         // check to see if this function is now always SAT
-        size_t dnf_variables = realized_dnf->get_variables().size();
+        size_t dnf_variables = realized_dnf.get_variables().size();
         size_t maximum_rows = 1 << dnf_variables;
-        if (dnf_variables == 0 or realized_dnf->get_table().size() == maximum_rows) {
+        if (dnf_variables == 0 or realized_dnf.total_rows() == maximum_rows) {
           // Remove this function entirely from this problem as it is always satisfied
-          remove_dnf(weak_dnf);
+          remove_dnf(handle);
+          continue;
         } else {
-          requires_assume_and_learn.insert(weak_dnf);
+          // Its shape changed, which changes its priorities
+          require_assume_and_learn(handle);
+          merge_order.push(handle, merge_key(realized_dnf));
+          scopes.set(handle, realized_dnf.get_variables());
+          // Its new variables may now contain, or be contained by, another DNF's
+          if (resolve_overlaps(handle) != handle) {
+            // The merged DNF was queued for propagation when it was added
+            continue;
+          }
         }
       }
       // We just finished propagating this dnf, so don't do it again
-      requires_knowledge_propagate.erase(weak_dnf);
+      requires_knowledge_propagate.erase(handle);
     }
   }
 }
 
-void Problem::add_dnf(const std::shared_ptr<DNF>& dnf) {
-  dnfs.insert(dnf);
-  std::weak_ptr<DNF> weak_dnf = dnf;
-  for (const auto v : dnf->get_variables()) {
-    variable_to_dnfs[v].insert(weak_dnf);
+void Problem::propagate_assumption(Knowledge& assumption) {
+  // Propagates without touching the problem, then copies out everything that was learned
+  make_contexts(1);
+  auto& context = assumptions[0];
+  context.push();
+  context.assume(assumption);
+  context.propagate();
+  assumption.add(context.knowledge());
+  context.pop();
+}
+
+void Problem::make_contexts(size_t total) {
+  while (assumptions.size() < total) {
+    assumptions.emplace_back(dnfs, variable_to_dnfs);
   }
-  requires_knowledge_propagate.insert(weak_dnf);
-  requires_assume_and_learn.insert(weak_dnf);
 }
 
-void Problem::remove_dnf(std::weak_ptr<DNF>& weak_dnf) {
-  auto realized_dnf = weak_dnf.lock();
-  assert(realized_dnf);
+dnf_handle Problem::add_dnf(DNF&& dnf) {
+  const auto handle = dnfs.insert(std::move(dnf));
+  for (const auto v : dnfs[handle].get_variables()) {
+    variable_to_dnfs[v].push_back(handle);
+  }
+  scopes.set(handle, dnfs[handle].get_variables());
+  requires_knowledge_propagate.insert(handle);
+  require_assume_and_learn(handle);
+  merge_order.push(handle, merge_key(dnfs[handle]));
+  return handle;
+}
+
+AssumeKey Problem::assume_key(const DNF& dnf) {
+  return {-dnf.get_variables().size(), dnf.total_rows()};
+}
+
+MergeKey Problem::merge_key(const DNF& dnf) {
+  const size_t rows = dnf.total_rows();
+  if (rows > 100) {
+    return std::make_tuple(true, rows, 0);
+  }
+  return std::make_tuple(false, -dnf.get_variables().size(), rows);
+}
+
+// Removes "handle" from a bin if it is there, without preserving order
+void erase_from_bin(vector<dnf_handle>& bin, dnf_handle handle) {
+  auto it = std::find(bin.begin(), bin.end(), handle);
+  if (it != bin.end()) {
+    *it = bin.back();
+    bin.pop_back();
+  }
+}
+
+DNF Problem::take_dnf(dnf_handle handle) {
+  assert(dnfs.contains(handle));
   // Remove it from variable bins
-  for (const auto v : realized_dnf->get_variables()) {
-    variable_to_dnfs[v].erase(weak_dnf);
+  for (const auto v : dnfs[handle].get_variables()) {
+    erase_from_bin(variable_to_dnfs[v], handle);
   }
-  requires_knowledge_propagate.erase(weak_dnf);
-  requires_assume_and_learn.erase(weak_dnf);
-  dnfs.erase(realized_dnf);
+  scopes.erase(handle);
+  requires_knowledge_propagate.erase(handle);
+  requires_assume_and_learn.erase(handle);
+  merge_order.erase(handle);
+  return dnfs.take(handle);
 }
 
-void Problem::clean_up_bins(const unordered_set<size_t>& update_required) {
-  weak_dnf_set need_cleaning;
+void Problem::remove_dnf(dnf_handle handle) {
+  take_dnf(handle);
+}
+
+void Problem::clean_up_bins(const UpdatedVariables& update_required) {
   for (const auto v : update_required) {
-    auto assigned_it = global_knowledge.assigned.find(v);
-    auto rewrite_it = global_knowledge.rewrites.find(v);
-    if (assigned_it != global_knowledge.assigned.end()) {
+    if (global_knowledge.is_assigned(v)) {
       // This variable has been assigned, so clear the bin
-      need_cleaning.insert(variable_to_dnfs[v].begin(), variable_to_dnfs[v].end());
       variable_to_dnfs[v].clear();
-    } else if (rewrite_it != global_knowledge.rewrites.end()) {
+    } else if (global_knowledge.is_rewritten(v)) {
       // This variable has been rewritten, so move the contents of its bin
-      const auto& rewrite = rewrite_it->second;
+      const auto rewrite = global_knowledge.rewrite(v);
       auto& moving = variable_to_dnfs[rewrite.from];
-      need_cleaning.insert(moving.begin(), moving.end());
-      variable_to_dnfs[rewrite.to].insert(moving.begin(), moving.end());
+      auto& destination = variable_to_dnfs[rewrite.to];
+      for (const auto handle : moving) {
+        // Bins are short, so a linear search is cheaper than keeping them sorted
+        if (std::find(destination.begin(), destination.end(), handle) == destination.end()) {
+          destination.push_back(handle);
+        }
+      }
       moving.clear();
     } else {
-      cout << "Cleaning a bit that isn't a global rule!" << endl;
+      LOG(LOG_ERROR) << "Cleaning a bit that isn't a global rule!";
       assert(false);
     }
   }
 }
 
-
 void Problem::add_knowledge(const Knowledge& knowledge) {
-  auto update_required = global_knowledge.add(knowledge);
+  updated.clear();
+  global_knowledge.add(knowledge, &updated);
   // Figure out which dnfs are directly affected by the new knowledge
-  for (const auto v : update_required) {
-    requires_knowledge_propagate.insert(variable_to_dnfs[v].begin(), variable_to_dnfs[v].end());
+  for (const auto v : updated) {
+    open_variable(requires_knowledge_propagate, v);
   }
-  clean_up_bins(update_required);
+  clean_up_bins(updated);
   // propagate the new knowledge
-  knowledge_propagate(global_knowledge, true);
+  knowledge_propagate();
 }
-std::shared_ptr<DNF> Problem::simple_convert(vector<unordered_map<size_t, bool>>& rows) {
+DNF Problem::simple_convert(vector<unordered_map<size_t, bool>>& rows) {
   vector<size_t> universal;
   assert(rows.size() > 0);
   for (const auto pair : rows[0]) {
@@ -289,11 +505,11 @@ std::shared_ptr<DNF> Problem::simple_convert(vector<unordered_map<size_t, bool>>
     }
     table.push_back(table_row);
   }
-  return std::make_shared<DNF>(universal, table);
+  return DNF(universal, table);
 }
 
 
-std::shared_ptr<DNF> Problem::old_convert(vector<unordered_map<size_t, bool>>& rows) {
+DNF Problem::old_convert(vector<unordered_map<size_t, bool>>& rows) {
   unordered_map<size_t, size_t> frequency;
 
   // Figure out how often each variable appears
@@ -318,10 +534,10 @@ std::shared_ptr<DNF> Problem::old_convert(vector<unordered_map<size_t, bool>>& r
     }
     table.push_back(table_row);
   }
-  return std::make_shared<DNF>(universal, table);
+  return DNF(universal, table);
 }
 
-std::shared_ptr<DNF> Problem::smart_convert(vector<unordered_map<size_t, bool>>& rows) {
+DNF Problem::smart_convert(vector<unordered_map<size_t, bool>>& rows) {
   // This function is like the other "convert"s, except it also tries to repair off-by-one variables
   unordered_map<size_t, size_t> frequency;
 
@@ -347,12 +563,13 @@ std::shared_ptr<DNF> Problem::smart_convert(vector<unordered_map<size_t, bool>>&
     } else if (seen == rows.size() - 1 and rows.size() < 1000) {
       // Find the first variable that appears in all but one row
       // Find the row that doesn't have this variable
-      size_t missing;
+      size_t missing = rows.size();
       for (size_t i=0; i < rows.size(); i++) {
         if (rows[i].count(variable) == 0) {
           missing = i;
         }
       }
+      assert(missing < rows.size());
       // Build up the two knowledges
       Knowledge with_zero;
       for (const auto pair : rows[missing]) {
@@ -363,6 +580,8 @@ std::shared_ptr<DNF> Problem::smart_convert(vector<unordered_map<size_t, bool>>&
       with_one.add(variable, true);
       propagate_assumption(with_zero);
       propagate_assumption(with_one);
+      const auto zero_assigned = with_zero.assignments();
+      const auto one_assigned = with_one.assignments();
       // remove the old row
       swap(rows[missing], rows.back());
       auto old_row = rows.back();
@@ -371,22 +590,22 @@ std::shared_ptr<DNF> Problem::smart_convert(vector<unordered_map<size_t, bool>>&
       if (not with_zero.is_unsat) {
         if (with_one.is_unsat) {
           // If only "with_zero" is sat
-          for (const auto pair : with_zero.assigned) {
+          for (const auto pair : zero_assigned) {
             if (old_row.count(pair.first) == 0) {
               frequency[pair.first]++;
               unprocessed.insert(pair.first);
             }
           }
-          cout << "Added 0" << endl;
-          rows.push_back(with_zero.assigned);
+          LOG(LOG_TRACE) << "Added 0";
+          rows.push_back(zero_assigned);
         } else {
           // both versions were still satisfiable, so combine their knowledge
-          for (const auto pair : with_zero.assigned) {
-            auto result = with_one.assigned.find(pair.first);
-            if (result != with_one.assigned.end() and result->second == pair.second) {
+          for (const auto pair : zero_assigned) {
+            auto result = one_assigned.find(pair.first);
+            if (result != one_assigned.end() and result->second == pair.second) {
               auto inserted = old_row.insert(pair);
               if (inserted.second) {
-                cout << "Inserted!" << endl;
+                LOG(LOG_TRACE) << "Inserted!";
                 frequency[pair.first]++;
               }
             }
@@ -395,17 +614,17 @@ std::shared_ptr<DNF> Problem::smart_convert(vector<unordered_map<size_t, bool>>&
         }
       } else if (not with_one.is_unsat) {
         // If only "with_one" is sat
-        for (const auto pair : with_one.assigned) {
+        for (const auto pair : one_assigned) {
           if (old_row.count(pair.first) == 0) {
             frequency[pair.first]++;
             unprocessed.insert(pair.first);
           }
         }
-        cout << "Added 1" << endl;
-        rows.push_back(with_one.assigned);
+        LOG(LOG_TRACE) << "Added 1";
+        rows.push_back(one_assigned);
       }
       if (with_zero.is_unsat and with_one.is_unsat) {
-        cout << "Both unsat, reopening everything" << endl;
+        LOG(LOG_TRACE) << "Both unsat, reopening everything";
         for (auto & pair : frequency) {
           if (old_row.count(pair.first)) {
             // You don't get counted in this row, but that can't change if you needed to be processed.
@@ -427,164 +646,375 @@ std::shared_ptr<DNF> Problem::smart_convert(vector<unordered_map<size_t, bool>>&
     }
     table.push_back(table_row);
   }
-  return std::make_shared<DNF>(ordered_universal, table);
+  return DNF(ordered_universal, table);
+}
+
+dnf_handle Problem::intern(dnf_handle handle) {
+  const auto same = scopes.find_same(handle);
+  if (same == NO_DNF) {
+    return handle;
+  }
+  // Hashing a lazy merge would build its rows only to compare them, while
+  // intersecting builds them once
+  if (not dnfs[same].is_lazy() and not dnfs[handle].is_lazy() and DNF::same_function(dnfs[same], dnfs[handle])) {
+    LOG(LOG_DEBUG) << "Found a duplicate of a function, removing it";
+    Statistics::add(DUPLICATES_REMOVED);
+    remove_dnf(handle);
+    return same;
+  }
+  LOG(LOG_DEBUG) << "Found a function with the same variables, intersecting them";
+  return merge(same, handle);
 }
 
-std::weak_ptr<DNF> Problem::resolve_overlaps(std::weak_ptr<DNF>& weak_dnf) {
-  auto realized_dnf = weak_dnf.lock();
-  assert(realized_dnf);
-  unordered_map<std::shared_ptr<DNF>, size_t> overlap_count;
-  // Count how often other dnf overlaps "weak_dnf"
-  for (const auto v : realized_dnf->get_variables()) {
-    for (const auto& weak_overlap : variable_to_dnfs[v]) {
-      assert(weak_overlap.lock());
-      overlap_count[weak_overlap.lock()]++;
+dnf_handle Problem::resolve_overlaps(dnf_handle handle) {
+  assert(dnfs.contains(handle));
+  const auto interned = intern(handle);
+  if (interned != handle) {
+    return interned;
+  }
+  const auto& variables = dnfs[handle].get_variables();
+  if (variables.empty()) {
+    return handle;
+  }
+  // A superset uses every variable of "handle", so only the smallest bin needs searching
+  size_t rarest = variables[0];
+  for (const auto v : variables) {
+    if (variable_to_dnfs[v].size() < variable_to_dnfs[rarest].size()) {
+      rarest = v;
     }
   }
-  // Ensure you don't find yourself
-  overlap_count.erase(realized_dnf);
-  for (const auto pair : overlap_count) {
-    if (pair.second == realized_dnf->get_variables().size()) {
-      // If pair.first has a superset of variables in realized_dnf, merge and stop
-      std::weak_ptr<DNF> weak_overlap = pair.first;
-      cout << "Found superset of working dnf, starting merge" << endl;
-      return merge(weak_overlap, weak_dnf);
-    } else if (pair.second == pair.first->get_variables().size()) {
-      // If all variables in pair.first are in realized_dnf
-      cout << "Found subset of working dnf, merging it in and recursing" << endl;
-      std::weak_ptr<DNF> weak_overlap = pair.first;
-      auto result = merge(weak_overlap, weak_dnf);
-      // TODO I'm not sure you need to recurse in this case
-      return resolve_overlaps(result);
+  for (const auto overlap : variable_to_dnfs[rarest]) {
+    if (overlap != handle and scopes.contains(overlap, handle)) {
+      // If overlap has a superset of variables in "handle", merge and stop
+      LOG(LOG_DEBUG) << "Found superset of working dnf, starting merge";
+      return merge(overlap, handle);
     }
   }
-  return weak_dnf;
+  const auto subset = scopes.find_subset(handle);
+  if (subset != NO_DNF) {
+    LOG(LOG_DEBUG) << "Found subset of working dnf, merging it in and recursing";
+    auto result = merge(subset, handle);
+    // TODO I'm not sure you need to recurse in this case
+    return resolve_overlaps(result);
+  }
+  return handle;
 }
 
 void Problem::assume_and_learn() {
+  PhaseTimer timer(ASSUME_AND_LEARN_PHASE);
+  // Assumptions are tested against individual rows, which a lazy merge only has
+  // once it is built, so those wait until merging builds them
+  vector<dnf_handle> lazy;
   while (not requires_assume_and_learn.empty()) {
-    print_short();
-    auto realized_dnf = requires_assume_and_learn.begin()->lock();
-    assert(realized_dnf);
-    std::pair<size_t, size_t> current_score = {-realized_dnf->get_variables().size(),realized_dnf->get_table().size()};
-    // Find the "best", this could probably be made more efficient
-    for (const auto weak_new : requires_assume_and_learn) {
-      auto realized_new = weak_new.lock();
-      assert(realized_new);
-      std::pair<size_t, size_t> new_score = {-realized_new->get_variables().size(), realized_new->get_table().size()};
-
-      if (current_score > new_score) {
-        realized_dnf = realized_new;
-        current_score = new_score;
-      }
+    log_short(LOG_DEBUG);
+    // The heap keeps the "best" on top
+    auto handle = requires_assume_and_learn.top();
+    assert(dnfs.contains(handle));
+    if (dnfs[handle].is_lazy()) {
+      requires_assume_and_learn.erase(handle);
+      lazy.push_back(handle);
+      continue;
     }
     // Temporarily remove it from the problem (will remove it from requires_assume_and_learn)
-    std::weak_ptr<DNF> weak_dnf = realized_dnf;
-    // TODO when you remove smart pointers, you'll need to make this safe again
-    remove_dnf(weak_dnf);
-    const auto& variables = realized_dnf->get_variables();
-    const auto& table = realized_dnf->get_table();
-    cout << "Before " << variables.size() << "x" << table.size() << endl;
-    vector<unordered_map<size_t, bool>> new_rows;
-    for (const auto& row : table) {
-      // Assume this row is true
-      Knowledge assumption;
-      for (size_t i=0; i < variables.size(); i++) {
-        assumption.add(variables[i], row[i]);
-      }
-      propagate_assumption(assumption);
-
-      if (not assumption.is_unsat) {
-        // Add the row back in (and its consequences) only if it didn't lead to a contradiction
-        new_rows.push_back(assumption.assigned);
+    const DNF realized_dnf = take_dnf(handle);
+    const auto& variables = realized_dnf.get_variables();
+    const auto total_rows = realized_dnf.total_rows();
+    LOG(LOG_DEBUG) << "Before " << variables.size() << "x" << total_rows;
+    // Rows are tested independently, with each thread using its own context
+    auto& pool = ThreadPool::global();
+    make_contexts(pool.size());
+    // The new function has the variables every surviving row assigned. Rows are
+    // tested in batches and narrowed to those variables as they go, so only one
+    // batch holds every assignment its rows caused.
+    const size_t batch = pool.size() * ASSUME_BATCH_PER_THREAD;
+    vector<unordered_map<size_t, bool>> row_results(std::min(batch, total_rows));
+    vector<char> survived(row_results.size());
+    vector<size_t> universal;
+    vector<vector<bool>> table;
+    for (size_t start=0; start < total_rows; start += batch) {
+      const size_t count = std::min(batch, total_rows - start);
+      pool.parallel_for(count, [&](size_t i) {
+        auto& context = assumptions[ThreadPool::worker_index()];
+        // Assume this row is true
+        context.push();
+        for (size_t c=0; c < variables.size(); c++) {
+          context.assume(variables[c], realized_dnf.get(start + i, c));
+        }
+        context.propagate();
+        Statistics::add(ASSUMPTIONS_TESTED);
+        survived[i] = not context.knowledge().is_unsat;
+        if (survived[i]) {
+          row_results[i] = context.knowledge().assignments();
+        } else {
+          Statistics::add(ASSUMPTIONS_REFUTED);
+        }
+        context.pop();
+      });
+      // Add the rows back in (and their consequences) only if they didn't lead to a contradiction,
+      // keeping the original row order regardless of which thread tested them
+      for (size_t i=0; i < count; i++) {
+        if (not survived[i]) {
+          continue;
+        }
+        const auto& row = row_results[i];
+        if (table.empty()) {
+          for (const auto& pair : row) {
+            universal.push_back(pair.first);
+          }
+        }
+        for (size_t u=0; u < universal.size(); u++) {
+          // If this "universal" variable isn't in this row, drop it from every row so far
+          if (row.count(universal[u]) == 0) {
+            universal[u] = universal.back();
+            universal.pop_back();
+            for (auto& kept : table) {
+              kept[u] = kept.back();
+              kept.pop_back();
+            }
+            u--;
+          }
+        }
+        vector<bool> values;
+        values.reserve(universal.size());
+        for (const auto v : universal) {
+          values.push_back(row.at(v));
+        }
+        table.push_back(std::move(values));
       }
     }
-    auto new_dnf = simple_convert(new_rows);
-    cout << "After " << new_dnf->get_variables().size() << "x" << new_dnf->get_table().size() << endl;
+    DNF converted(universal, table);
+    LOG(LOG_DEBUG) << "After " << converted.get_variables().size() << "x" << converted.total_rows();
     // Add it back into the problem
-    add_dnf(new_dnf);
+    auto new_handle = add_dnf(std::move(converted));
     // Resolve any subset/superset relationships this new dnf may ave
-    std::weak_ptr<DNF> weak_new = new_dnf;
-    weak_new = resolve_overlaps(weak_new);
-    new_dnf = weak_new.lock();
+    new_handle = resolve_overlaps(new_handle);
+    const auto& new_dnf = dnfs[new_handle];
     // If the variables or the rows changed
-    if (new_dnf->get_variables().size() != variables.size() or new_dnf->get_table().size() != table.size()) {
+    if (new_dnf.get_variables().size() != variables.size() or new_dnf.total_rows() != total_rows) {
       // Anything that overlaps this DNF could now potentially have a row removed
-      for (const auto v : new_dnf->get_variables()) {
-        requires_assume_and_learn.insert(variable_to_dnfs[v].begin(), variable_to_dnfs[v].end());
+      for (const auto v : new_dnf.get_variables()) {
+        for (const auto overlap : variable_to_dnfs[v]) {
+          require_assume_and_learn(overlap);
+        }
       }
-      auto learned = new_dnf->create_knowledge();
+      auto learned = new_dnf.create_knowledge();
+      count_learned(learned);
       if (not learned.empty()) {
-        std::cout << "Learned something new" << std::endl;
-        learned.print();
-        std::cout << std::endl;
+        if (Log::enabled(LOG_DEBUG)) {
+          LogLine line(LOG_DEBUG);
+          line.stream() << "Learned something new" << std::endl;
+          learned.print(line.stream());
+        }
         add_knowledge(learned);
         if (global_knowledge.is_unsat) {
           return;
         }
       }
     }
-    requires_assume_and_learn.erase(new_dnf);
+    requires_assume_and_learn.erase(new_handle);
   }
-  print_short();
+  for (const auto handle : lazy) {
+    if (dnfs.contains(handle)) {
+      require_assume_and_learn(handle);
+    }
+  }
+  log_short(LOG_DEBUG);
 }
 
-std::weak_ptr<DNF> Problem::merge(std::weak_ptr<DNF>& weak_a, std::weak_ptr<DNF>& weak_b) {
-  auto realized_a = weak_a.lock();
-  auto realized_b = weak_b.lock();
-  assert(realized_a and realized_b);
-  auto realized_new = std::make_shared<DNF>(DNF::merge(*realized_a, *realized_b));
-  cout << "Merged: " << realized_a->get_table().size()
-       << "+" << realized_b->get_table().size()
-       << "=" << realized_new->get_table().size() << endl;
-  remove_dnf(weak_a);
-  remove_dnf(weak_b);
-  add_dnf(realized_new);
-  return realized_new;
+dnf_handle Problem::merge(dnf_handle a, dnf_handle b) {
+  PhaseTimer timer(MERGE_PHASE);
+  assert(dnfs.contains(a) and dnfs.contains(b));
+  // During propagation an input may not have seen the knowledge its bins already
+  // reflect, and removing it must find it in the bins of its current variables
+  for (const auto handle : {a, b}) {
+    const size_t rows_before = dnfs[handle].total_rows();
+    dnfs[handle].apply_knowledge(global_knowledge);
+    Statistics::add(ROWS_REMOVED, rows_before - dnfs[handle].total_rows());
+  }
+  return replace_merged(a, b, DNF::merge(dnfs[a], dnfs[b]));
+}
+
+size_t Problem::memory_bytes() const {
+  size_t total = dnfs.memory_bytes() + vector_bytes(variable_to_dnfs) + scopes.memory_bytes()
+      + requires_knowledge_propagate.memory_bytes() + requires_assume_and_learn.memory_bytes()
+      + merge_order.memory_bytes() + global_knowledge.memory_bytes() + vector_bytes(assumptions)
+      + updated.memory_bytes();
+  for (const auto& bin : variable_to_dnfs) {
+    total += vector_bytes(bin);
+  }
+  for (const auto& context : assumptions) {
+    total += context.memory_bytes();
+  }
+  return total;
+}
+
+bool Problem::heuristic_merge() {
+  PhaseTimer timer(MERGE_PHASE);
+  size_t used = memory_bytes();
+  Statistics::maximum(LARGEST_MEMORY_USE, used);
+  if (used >= memory_budget) {
+    LOG(LOG_WARNING) << "Using " << used << " bytes, which leaves nothing of the "
+                     << memory_budget << " byte memory budget to merge with";
+    return false;
+  }
+  const size_t unknown = total_variables - global_knowledge.assigned_count() - global_knowledge.rewrite_count();
+  const auto firsts = merge_order.best(MERGE_FIRST_CANDIDATES);
+  if (firsts.size() < 2) {
+    return false;
+  }
+  struct Candidate {
+    size_t estimate;
+    dnf_handle a, b;
+  };
+  vector<Candidate> candidates;
+  std::set<std::pair<dnf_handle, dnf_handle>> seen;
+  // Returns false if the pair was already a candidate
+  auto consider = [&](dnf_handle a, dnf_handle b) {
+    if (a == b or not seen.insert(std::minmax(a, b)).second) {
+      return false;
+    }
+    candidates.push_back({DNF::estimate_merge_rows(dnfs[a], dnfs[b]), a, b});
+    return true;
+  };
+  for (size_t i=0; i < firsts.size(); i++) {
+    // Pairs of the best DNFs, starting with the pair "merge_order" alone would choose
+    for (size_t j=i + 1; j < firsts.size(); j++) {
+      consider(firsts[i], firsts[j]);
+    }
+    // Shared variables are what keep a merge from being a full cross product
+    size_t partners = 0;
+    const auto& variables = dnfs[firsts[i]].get_variables();
+    for (size_t k=0; k < variables.size() and partners < MERGE_PARTNER_CANDIDATES; k++) {
+      const auto& bin = variable_to_dnfs[variables[k]];
+      for (size_t j=0; j < bin.size() and partners < MERGE_PARTNER_CANDIDATES; j++) {
+        if (consider(firsts[i], bin[j])) {
+          partners++;
+        }
+      }
+    }
+  }
+  // Smallest predicted output first, with ties in the order they were found
+  std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& x, const Candidate& y) {
+    return x.estimate < y.estimate;
+  });
+  for (const auto& candidate : candidates) {
+    // A lazy input is built once here, rather than copied by every merge it is tried in
+    for (const auto handle : {candidate.a, candidate.b}) {
+      if (dnfs[handle].is_lazy()) {
+        dnfs[handle].materialize();
+        used = memory_bytes();
+      }
+    }
+    size_t row_limit = max_merge_rows;
+    if (memory_budget != NO_MEMORY_LIMIT) {
+      // What is left must hold the output's table, and for each row its bit in
+      // every assumption context's mask and the row "assume_and_learn" builds
+      // from it, which has at most a bit per unknown variable. The assignments
+      // "assume_and_learn" keeps for the batch of rows it is testing are not
+      // counted, since they are bounded by the batch size rather than the output.
+      // Lazy merges are later built to this many rows.
+      auto columns = dnfs[candidate.a].get_variables();
+      const auto& b_variables = dnfs[candidate.b].get_variables();
+      columns.insert(columns.end(), b_variables.begin(), b_variables.end());
+      std::sort(columns.begin(), columns.end());
+      const size_t merged_columns = std::unique(columns.begin(), columns.end()) - columns.begin();
+      const size_t row_bytes = (assumptions.size() + 7) / 8
+          + (unknown + 63) / 64 * sizeof(uint64_t) + sizeof(vector<bool>);
+      const size_t left = memory_budget - std::min(used, memory_budget);
+      row_limit = std::min(row_limit, DNF::rows_within(merged_columns, left, row_bytes));
+    }
+    DNF merged;
+    if (DNF::try_lazy_merge(dnfs[candidate.a], dnfs[candidate.b], row_limit, merged)) {
+      LOG(LOG_DEBUG) << "Predicted " << candidate.estimate << " rows"
+                     << (merged.is_lazy() ? ", kept as a join" : "");
+      replace_merged(candidate.a, candidate.b, std::move(merged));
+      return true;
+    }
+    Statistics::add(MERGES_REFUSED);
+    LOG(LOG_DEBUG) << "Refused merge: " << dnfs[candidate.a].total_rows()
+                   << "+" << dnfs[candidate.b].total_rows()
+                   << " predicted " << candidate.estimate << " rows";
+  }
+  if (memory_budget == NO_MEMORY_LIMIT) {
+    LOG(LOG_INFO) << "Every candidate merge has more than " << max_merge_rows << " rows";
+  } else if (max_merge_rows == NO_ROW_LIMIT) {
+    LOG(LOG_INFO) << "Every candidate merge would exceed the memory budget, with " << used << " bytes in use";
+  } else {
+    LOG(LOG_INFO) << "Every candidate merge has more than " << max_merge_rows
+                  << " rows or would exceed the memory budget, with " << used << " bytes in use";
+  }
+  return false;
+}
+
+dnf_handle Problem::replace_merged(dnf_handle a, dnf_handle b, DNF&& merged) {
+  Statistics::add(MERGES);
+  Statistics::add(MERGE_INPUT_ROWS, dnfs[a].total_rows() + dnfs[b].total_rows());
+  Statistics::add(MERGE_OUTPUT_ROWS, merged.total_rows());
+  Statistics::maximum(LARGEST_MERGE_OUTPUT, merged.total_rows());
+  LOG(LOG_INFO) << "Merged: " << dnfs[a].total_rows()
+                 << "+" << dnfs[b].total_rows()
+                 << "=" << merged.total_rows();
+  remove_dnf(a);
+  if (b != a) {
+    remove_dnf(b);
+  }
+  return intern(add_dnf(std::move(merged)));
 }
 
 
 void Problem::sanity_check() {
   bool failure = false;
-  for (const auto dnf : dnfs) {
-    std::weak_ptr<DNF> weak_dnf = dnf;
+  for (const auto handle : dnfs.live()) {
+    const auto& dnf = dnfs[handle];
     // Check that this DNF is in all of the bins it should be
-    for (const auto v : dnf->get_variables()) {
-      if (variable_to_dnfs[v].count(weak_dnf) == 0) {
-        std::cout << "Failed to find DNF in bin: " << v << std::endl;
-        dnf->print();
+    for (const auto v : dnf.get_variables()) {
+      const auto& bin = variable_to_dnfs[v];
+      if (std::find(bin.begin(), bin.end(), handle) == bin.end()) {
+        LogLine line(LOG_ERROR);
+        line.stream() << "Failed to find DNF in bin: " << v << std::endl;
+        dnf.print(line.stream());
         failure = true;
       }
     }
   }
   // Check that all bins only contain the correct dnfs
   for (size_t v=0; v < variable_to_dnfs.size(); v++) {
-    for (const auto weak_dnf : variable_to_dnfs[v]) {
-      if(auto realized_dnf = weak_dnf.lock()) {
-        const auto& variables = realized_dnf->get_variables();
+    for (const auto handle : variable_to_dnfs[v]) {
+      if (dnfs.contains(handle)) {
+        const auto& variables = dnfs[handle].get_variables();
         if (std::find(variables.begin(), variables.end(), v) == variables.end()) {
-          std::cout << "DNF in bin " << v << " does not contain that variable" << std::endl;
-          realized_dnf->print();
+          LogLine line(LOG_ERROR);
+          line.stream() << "DNF in bin " << v << " does not contain that variable" << std::endl;
+          dnfs[handle].print(line.stream());
           failure = true;
         }
       } else {
-        std::cout << "DNF in bin " << v << " has been deleted." << std::endl;
+        LOG(LOG_ERROR) << "DNF in bin " << v << " has been deleted.";
         failure = true;
       }
     }
   }
-  // Check that the weak sets don't contain dead things
-  for (const auto weak_dnf : requires_knowledge_propagate) {
-    if (not weak_dnf.lock()) {
-      std::cout << "Dead dnf found in requires_knowledge_propagate" << std::endl;
+  // Check that the work lists don't contain dead things
+  for (const auto handle : requires_knowledge_propagate) {
+    if (not dnfs.contains(handle)) {
+      LOG(LOG_ERROR) << "Dead dnf found in requires_knowledge_propagate";
       failure = true;
     }
   }
-  for (const auto weak_dnf : requires_assume_and_learn) {
-    if (not weak_dnf.lock()) {
-      std::cout << "Dead dnf found in requires_assume_and_learn" << std::endl;
+  for (const auto handle : requires_assume_and_learn.handles()) {
+    if (not dnfs.contains(handle)) {
+      LOG(LOG_ERROR) << "Dead dnf found in requires_assume_and_learn";
       failure = true;
     }
   }
+  // Check that every DNF can be picked for merging
+  if (merge_order.size() != dnfs.size()) {
+    LOG(LOG_ERROR) << "merge_order has " << merge_order.size() << " of " << dnfs.size() << " dnfs";
+    failure = true;
+  }
+  if (failure) {
+    // Write the errors before the assert aborts
+    Log::flush();
+  }
   assert(not failure);
 }
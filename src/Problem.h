@@ -2,55 +2,114 @@
 // and knows how to manipulate the problem
 #ifndef PROBLEM_H_
 #define PROBLEM_H_
-// TODO "propagate_assumption" can screw with "knowledge_propagate" by making
-// the problem think DNFs have been propagated even when they haven't.
-// TODO Remove smart pointers and replace with regular pointers
-#include <memory>
 #include <iostream>
-#include <set>
 #include <unordered_set>
+#include <unordered_map>
+#include <tuple>
 
 #include "DNF.h"
+#include "DNFArena.h"
+#include "IndexedHeap.h"
 #include "Knowledge.h"
+#include "Log.h"
+#include "PropagationContext.h"
 
 using std::string;
 
-// This is a "set" and not an "unordered_set" because weak_ptr doesn't
-// have a safe, immutable hash function
-using weak_dnf_set=std::set<std::weak_ptr<DNF>,std::owner_less<std::weak_ptr<DNF>>>;
+// Clauses read from a .cnf file are grouped into functions of at most this many variables
+const size_t CNF_GROUP_LIMIT = SMALL_LIMIT;
+// Memory budget that never stops a merge
+const size_t NO_MEMORY_LIMIT = ~size_t(0);
+
+// Smaller is better. Functions with more variables are assumed first, then fewer rows.
+using AssumeKey = std::pair<size_t, size_t>;
+// Smaller is better. Functions with at most 100 rows go first, preferring more
+// variables and then fewer rows. Larger functions follow, preferring fewer rows.
+using MergeKey = std::tuple<bool, size_t, size_t>;
 
 class Problem {
  public:
+  Problem() = default;
+  // The assumption contexts refer to this problem's DNFs and bins, so a copy
+  // (or move) would leave them referring to the original
+  Problem(const Problem&) = delete;
+  Problem& operator=(const Problem&) = delete;
   void load(const string& filename);
+  // Saves everything needed to continue solving from this point
+  void save_checkpoint(const string& filename) const;
+  // Replaces the problem with one saved by "save_checkpoint"
+  void load_checkpoint(const string& filename);
   void print(std::ostream& out=std::cout) const;
   void print_short(std::ostream& out=std::cout) const;
+  // Logs "print_short" at "level", only computing it if the level is enabled
+  void log_short(LogLevel level) const;
 
   void knowledge_propagate();
   void propagate_assumption(Knowledge& assumption);
 
   void assume_and_learn();
-  std::weak_ptr<DNF> merge(std::weak_ptr<DNF>& weak_a, std::weak_ptr<DNF>& weak_b);
+  dnf_handle merge(dnf_handle a, dnf_handle b);
+  // Merges the pair predicted to output the fewest rows, from pairs involving the
+  // first few DNFs in "merge_order". Returns false if there is no pair to merge,
+  // every pair would output more than "max_merge_rows", or the output would not
+  // fit in "memory_budget".
+  bool heuristic_merge();
+  // Largest merge "heuristic_merge" will perform
+  size_t max_merge_rows = NO_ROW_LIMIT;
+  // Bytes "memory_bytes" may reach through merging
+  size_t memory_budget = NO_MEMORY_LIMIT;
+  // Heap memory held by every DNF, index and piece of knowledge in the problem
+  size_t memory_bytes() const;
 
   // TODO most of these things should probably be private
-  std::unordered_set<std::shared_ptr<DNF>> dnfs;
-  vector<weak_dnf_set> variable_to_dnfs;
-  weak_dnf_set requires_knowledge_propagate;
-  weak_dnf_set requires_assume_and_learn;
+  DNFArena dnfs;
+  // For each variable, the DNFs which use it
+  vector<vector<dnf_handle>> variable_to_dnfs;
+  // The variables of every DNF, used to find DNFs whose variables contain another's
+  ScopeIndex scopes;
+  HandleSet requires_knowledge_propagate;
+  IndexedHeap<AssumeKey> requires_assume_and_learn;
+  // Every DNF, ordered by which should be merged first
+  IndexedHeap<MergeKey> merge_order;
   Knowledge global_knowledge;
   void sanity_check();
  private:
-  std::weak_ptr<DNF> resolve_overlaps(std::weak_ptr<DNF>& weak_dnf);
-  void knowledge_propagate(Knowledge& knowledge, bool modify_in_place);
+  // Used to test assumptions without modifying the problem, one for each thread
+  vector<PropagationContext> assumptions;
+  // Scratch space for the variables each addition to "global_knowledge" changed
+  UpdatedVariables updated;
+  // Ensures there are at least "total" contexts in "assumptions"
+  void make_contexts(size_t total);
+  void clear();
+  // Keeps one DNF for each set of variables. If another DNF has the variables of
+  // "handle", either it is the same function and "handle" is removed, or the two
+  // are merged. Returns the handle of what remains.
+  dnf_handle intern(dnf_handle handle);
+  dnf_handle resolve_overlaps(dnf_handle handle);
   void load_dnf(const string& filename);
+  void load_cnf(const string& filename);
   void add_knowledge(const Knowledge& knowledge);
-  //Knowledge knowledge_propagate(const Knowledge& knowledge, weak_dnf_set& open_set, bool modify_in_place);
-  void add_dnf(const std::shared_ptr<DNF>& dnf);
-  void remove_dnf(std::weak_ptr<DNF>& weak_dnf);
-  void clean_up_bins(const unordered_set<size_t>& require_updating);
-
-  std::shared_ptr<DNF> simple_convert(vector<std::unordered_map<size_t, bool>>& rows);
-  std::shared_ptr<DNF> old_convert(vector<std::unordered_map<size_t, bool>>& rows);
-  std::shared_ptr<DNF> smart_convert(vector<std::unordered_map<size_t, bool>>& rows);
+  dnf_handle add_dnf(DNF&& dnf);
+  // Replaces "a" and "b" with "merged"
+  dnf_handle replace_merged(dnf_handle a, dnf_handle b, DNF&& merged);
+  static AssumeKey assume_key(const DNF& dnf);
+  static MergeKey merge_key(const DNF& dnf);
+  // Adds (or updates) "handle" in "requires_assume_and_learn"
+  void require_assume_and_learn(dnf_handle handle) {
+    requires_assume_and_learn.push(handle, assume_key(dnfs[handle]));
+  }
+  void remove_dnf(dnf_handle handle);
+  // Removes the DNF from the problem but returns it instead of destroying it
+  DNF take_dnf(dnf_handle handle);
+  void clean_up_bins(const UpdatedVariables& require_updating);
+  // Queues every DNF that uses variable "v"
+  void open_variable(HandleSet& open_set, size_t v) {
+    open_set.insert(variable_to_dnfs[v].begin(), variable_to_dnfs[v].end());
+  }
+
+  DNF simple_convert(vector<std::unordered_map<size_t, bool>>& rows);
+  DNF old_convert(vector<std::unordered_map<size_t, bool>>& rows);
+  DNF smart_convert(vector<std::unordered_map<size_t, bool>>& rows);
   size_t total_variables;
 };
 
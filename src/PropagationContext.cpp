@@ -0,0 +1,116 @@
+#include "PropagationContext.h"
+#include "Statistics.h"
+#include <cassert>
+
+PropagationContext::PropagationContext(const DNFArena& dnfs_, const vector<vector<dnf_handle>>& variable_to_dnfs_)
+    : dnfs(dnfs_), variable_to_dnfs(variable_to_dnfs_) {
+}
+
+size_t PropagationContext::memory_bytes() const {
+  size_t total = known.memory_bytes() + open.memory_bytes() + vector_bytes(masks) + vector_bytes(trail)
+      + vector_bytes(marks) + vector_bytes(before) + updated.memory_bytes();
+  for (const auto& mask : masks) {
+    total += vector_bytes(mask.words);
+  }
+  return total;
+}
+
+void PropagationContext::push() {
+  marks.push_back(trail.size());
+  known.checkpoint();
+}
+
+void PropagationContext::pop() {
+  assert(not marks.empty());
+  while (trail.size() > marks.back()) {
+    const auto& change = trail.back();
+    auto& mask = masks[change.slot];
+    if (mask.fills == change.fill) {
+      mask.words[change.word] = change.old;
+    }
+    trail.pop_back();
+  }
+  marks.pop_back();
+  known.rollback();
+  open.clear();
+}
+
+void PropagationContext::assume(size_t variable, bool value) {
+  updated.clear();
+  known.add(variable, value, &updated);
+  open_updated();
+}
+
+void PropagationContext::assume(const Knowledge& assumption) {
+  updated.clear();
+  known.add(assumption, &updated);
+  open_updated();
+}
+
+void PropagationContext::open_updated() {
+  for (const auto v : updated) {
+    if (v < variable_to_dnfs.size()) {
+      open.insert(variable_to_dnfs[v].begin(), variable_to_dnfs[v].end());
+    }
+  }
+}
+
+PropagationContext::RowMask& PropagationContext::mask_for(dnf_handle handle) {
+  const size_t slot = DNFArena::slot_of(handle);
+  if (slot >= masks.size()) {
+    masks.resize(slot + 1);
+  }
+  auto& mask = masks[slot];
+  const auto& dnf = dnfs[handle];
+  if (mask.owner != handle or mask.version != dnf.get_version() or mask.small != dnf.is_small()
+      or mask.lazy != dnf.is_lazy() or mask.rows != dnf.total_rows() or mask.words.size() != dnf.mask_words()) {
+    mask.owner = handle;
+    mask.version = dnf.get_version();
+    mask.small = dnf.is_small();
+    mask.lazy = dnf.is_lazy();
+    mask.rows = dnf.total_rows();
+    mask.fills++;
+    mask.words.resize(dnf.mask_words());
+    dnf.fill_mask(mask.words.data());
+  }
+  return mask;
+}
+
+void PropagationContext::propagate() {
+  while (not open.empty()) {
+    // Process everything once before repeating anything
+    vector<dnf_handle> buffer(open.begin(), open.end());
+    open.clear();
+    while (buffer.size() > 0) {
+      const auto handle = buffer.back();
+      buffer.pop_back();
+      if (not dnfs.contains(handle)) {
+        continue;
+      }
+      Statistics::add(ASSUMPTION_DNFS_VISITED);
+      const auto& dnf = dnfs[handle];
+      auto& mask = mask_for(handle);
+      // Remove rows which contradict the assumptions, recording every word that changes
+      before.assign(mask.words.begin(), mask.words.end());
+      dnf.restrict(known, mask.words.data());
+      for (size_t w=0; w < before.size(); w++) {
+        if (before[w] != mask.words[w]) {
+          trail.push_back({DNFArena::slot_of(handle), w, before[w], mask.fills});
+        }
+      }
+      auto learned = dnf.create_knowledge(mask.words.data());
+      if (not learned.empty()) {
+        updated.clear();
+        known.add(learned, &updated);
+        if (known.is_unsat) {
+          // Do not go further, just return what made you UNSAT
+          open.clear();
+          return;
+        }
+        open_updated();
+      }
+      // We just finished propagating this dnf, so don't do it again
+      open.erase(handle);
+    }
+  }
+}
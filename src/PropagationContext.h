@@ -0,0 +1,76 @@
+// Propagates assumptions over a problem's DNFs without modifying them.
+// Instead of copying a DNF to apply an assumption, rows the assumption rules out
+// are cleared from a per-DNF row mask, and every cleared word is recorded on a
+// trail. Undoing an assumption replays the trail, so it costs time proportional
+// to what the assumption changed.
+#ifndef PROPAGATIONCONTEXT_H_
+#define PROPAGATIONCONTEXT_H_
+
+#include <vector>
+using std::vector;
+#include <cstdint>
+
+#include "DNFArena.h"
+#include "Knowledge.h"
+
+class PropagationContext {
+ public:
+  PropagationContext(const DNFArena& dnfs, const vector<vector<dnf_handle>>& variable_to_dnfs);
+  // Everything known under the current assumptions
+  const Knowledge& knowledge() const {
+    return known;
+  }
+  // Starts a new assumption on top of the current ones
+  void push();
+  // Undoes everything since the matching "push"
+  void pop();
+  // Adds to the current assumption without propagating it
+  void assume(size_t variable, bool value);
+  void assume(const Knowledge& assumption);
+  // Applies the assumptions to every affected DNF until nothing new is learned
+  // or a contradiction is found
+  void propagate();
+  // Heap memory held by the masks, knowledge and scratch space
+  size_t memory_bytes() const;
+ private:
+  const DNFArena& dnfs;
+  const vector<vector<dnf_handle>>& variable_to_dnfs;
+  Knowledge known;
+  HandleSet open;
+
+  // Outside of any assumption every mask keeps all of its DNF's rows, so a mask
+  // only needs to be refilled when the DNF in that slot was replaced or changed
+  // in place. The layout is part of the key since a truth table and a row
+  // table can have the same number of rows and mask words.
+  struct RowMask {
+    dnf_handle owner = NO_DNF;
+    uint64_t version = 0;
+    bool small = false, lazy = false;
+    size_t rows = 0;
+    // Counts refills, so changes recorded against an older fill are not undone
+    // onto the new one
+    size_t fills = 0;
+    vector<uint64_t> words;
+  };
+  // Indexed by arena slot
+  vector<RowMask> masks;
+  // A mask word and what it held before an assumption changed it
+  struct Change {
+    size_t slot, word;
+    uint64_t old;
+    size_t fill;
+  };
+  vector<Change> trail;
+  // Trail length at each "push"
+  vector<size_t> marks;
+  // Scratch space used to find which words "restrict" changed
+  vector<uint64_t> before;
+  // Scratch space for the variables each "Knowledge::add" changed
+  UpdatedVariables updated;
+
+  RowMask& mask_for(dnf_handle handle);
+  // Opens every DNF using a variable in "updated"
+  void open_updated();
+};
+
+#endif /* PROPAGATIONCONTEXT_H_ */
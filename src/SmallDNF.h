@@ -0,0 +1,154 @@
+// Operations on functions of at most six variables, stored as a single 64-bit
+// truth table. Bit "p" of the table is set if the assignment giving variable "i"
+// the value "(p >> i) & 1" is a row of the function. Every operation is a few
+// shifts and masks, with the number of variables fixed at compile time.
+#ifndef SMALLDNF_H_
+#define SMALLDNF_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+using std::size_t;
+
+#include "ColumnKernel.h"
+
+// Largest number of variables stored as a truth table
+const size_t SMALL_LIMIT = 6;
+
+// Table positions where variable "i" is 1
+inline uint64_t small_variable_mask(size_t i) {
+  static const uint64_t masks[SMALL_LIMIT] = {
+      0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+      0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL };
+  return masks[i];
+}
+
+// Exchanges variables "i" and "j" in any truth table
+inline uint64_t small_swap_variables(uint64_t table, size_t i, size_t j) {
+  if (i == j) {
+    return table;
+  }
+  if (i > j) {
+    std::swap(i, j);
+  }
+  // Positions with "i"=1 and "j"=0 trade places with those that have "i"=0 and "j"=1
+  const size_t shift = (size_t(1) << j) - (size_t(1) << i);
+  const uint64_t lower = small_variable_mask(i) & ~small_variable_mask(j);
+  const uint64_t delta = (table ^ (table >> shift)) & lower;
+  return table ^ delta ^ (delta << shift);
+}
+
+// Inverts the meaning of variable "i" in any truth table
+inline uint64_t small_negate_variable(uint64_t table, size_t i) {
+  const size_t shift = size_t(1) << i;
+  const uint64_t ones = small_variable_mask(i);
+  return ((table & ones) >> shift) | ((table & ~ones) << shift);
+}
+
+template <size_t N>
+struct SmallDNF {
+  static_assert(N <= SMALL_LIMIT, "SmallDNF only supports up to SMALL_LIMIT variables");
+  // Number of possible assignments
+  static const size_t positions = size_t(1) << N;
+
+  // Every position in a table of N variables
+  static uint64_t full() {
+    return positions == 64 ? ~uint64_t(0) : (uint64_t(1) << positions) - 1;
+  }
+
+  // Keeps only the rows where variable "i" has "value", then removes variable "i".
+  // Like DNF::remove_column, the last variable takes the place of "i".
+  static uint64_t remove(uint64_t table, size_t i, bool value) {
+    static_assert(N > 0, "No variable to remove");
+    table = small_swap_variables(table, i, N - 1);
+    const size_t half = positions / 2;
+    if (value) {
+      return table >> half;
+    }
+    return table & SmallDNF<N - 1>::full();
+  }
+
+  // Removes variable "i", keeping every row regardless of its value
+  static uint64_t project(uint64_t table, size_t i) {
+    static_assert(N > 0, "No variable to remove");
+    table = small_swap_variables(table, i, N - 1);
+    const size_t half = positions / 2;
+    return (table >> half) | (table & SmallDNF<N - 1>::full());
+  }
+
+  // Keeps only the rows where variables "i" and "j" are equal (or opposite if "negated")
+  static uint64_t filter(uint64_t table, size_t i, size_t j, bool negated) {
+    const uint64_t differ = small_variable_mask(i) ^ small_variable_mask(j);
+    return table & (negated ? differ : ~differ);
+  }
+
+  // Adds variable N, which can take either value in every row
+  static uint64_t extend(uint64_t table) {
+    static_assert(N < SMALL_LIMIT, "Too many variables");
+    return table | (table << positions);
+  }
+
+  // Finds constant variables and pairs of variables that are always equal or opposite
+  static ColumnRelations relations(uint64_t table) {
+    ColumnRelations result;
+    result.constant.assign(N, -1);
+    for (size_t i=0; i < N; i++) {
+      const uint64_t ones = small_variable_mask(i) & full();
+      if ((table & ones) == 0) {
+        result.constant[i] = 0;
+      } else if ((table & ~ones) == 0) {
+        result.constant[i] = 1;
+      }
+    }
+    for (size_t i=0; i < N; i++) {
+      if (result.constant[i] != -1) {
+        continue;
+      }
+      for (size_t j=i+1; j < N; j++) {
+        if (result.constant[j] != -1) {
+          continue;
+        }
+        const uint64_t differ = small_variable_mask(i) ^ small_variable_mask(j);
+        if ((table & differ) == 0) {
+          result.relations.push_back({i, j, false});
+        } else if ((table & ~differ) == 0) {
+          result.relations.push_back({i, j, true});
+        }
+      }
+    }
+    return result;
+  }
+};
+
+// Runtime entry points to SmallDNF<N>, so callers can pick N by the number of variables.
+// Operations that would leave 0 variables or need more than SMALL_LIMIT are left null.
+struct SmallOps {
+  uint64_t (*full)();
+  uint64_t (*remove)(uint64_t table, size_t i, bool value);
+  uint64_t (*project)(uint64_t table, size_t i);
+  uint64_t (*filter)(uint64_t table, size_t i, size_t j, bool negated);
+  uint64_t (*extend)(uint64_t table);
+  ColumnRelations (*relations)(uint64_t table);
+};
+
+template <size_t N>
+const SmallOps& make_small_ops() {
+  static const SmallOps ops = {
+    SmallDNF<N>::full,
+    N > 0 ? SmallDNF<(N > 0 ? N : 1)>::remove : nullptr,
+    N > 0 ? SmallDNF<(N > 0 ? N : 1)>::project : nullptr,
+    SmallDNF<N>::filter,
+    N < SMALL_LIMIT ? SmallDNF<(N < SMALL_LIMIT ? N : 0)>::extend : nullptr,
+    SmallDNF<N>::relations };
+  return ops;
+}
+
+inline const SmallOps& small_ops(size_t n) {
+  static const SmallOps* ops[SMALL_LIMIT + 1] = {
+      &make_small_ops<0>(), &make_small_ops<1>(), &make_small_ops<2>(),
+      &make_small_ops<3>(), &make_small_ops<4>(), &make_small_ops<5>(),
+      &make_small_ops<6>() };
+  return *ops[n];
+}
+
+#endif /* SMALLDNF_H_ */
@@ -0,0 +1,164 @@
+#include "Statistics.h"
+#include "Log.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <system_error>
+#include <thread>
+
+bool Statistics::enabled = false;
+
+// Names used in the report, in the same order as the enums
+const char* const COUNTER_NAMES[TOTAL_COUNTERS] = {
+    "propagation_rounds", "dnfs_visited", "assumption_dnfs_visited", "rows_removed",
+    "knowledge_created", "facts_learned", "assumptions_tested", "assumptions_refuted",
+    "merges", "merge_input_rows", "merge_output_rows", "largest_merge_output",
+    "merges_refused", "largest_memory_use", "duplicates_removed" };
+const char* const PHASE_NAMES[TOTAL_PHASES] = {
+    "load", "knowledge_propagate", "assume_and_learn", "merge", "checkpoint" };
+
+std::mutex Statistics::blocks_mutex;
+std::vector<std::unique_ptr<Statistics::Block>> Statistics::blocks;
+std::chrono::steady_clock::time_point enabled_at;
+
+// Background reporting
+std::mutex reporting_mutex;
+std::condition_variable reporting_wake;
+std::thread reporter;
+bool reporting = false;
+string report_filename;
+
+Statistics::Block::Block() {
+  for (auto& counter : counters) {
+    counter.store(0, std::memory_order_relaxed);
+  }
+  for (size_t p=0; p < TOTAL_PHASES; p++) {
+    phase_calls[p].store(0, std::memory_order_relaxed);
+    phase_nanoseconds[p].store(0, std::memory_order_relaxed);
+  }
+}
+
+void Statistics::enable() {
+  enabled = true;
+  enabled_at = std::chrono::steady_clock::now();
+}
+
+Statistics::Block& Statistics::local() {
+  thread_local Block* block = nullptr;
+  if (block == nullptr) {
+    block = new Block();
+    std::lock_guard<std::mutex> lock(blocks_mutex);
+    blocks.emplace_back(block);
+  }
+  return *block;
+}
+
+void Statistics::maximum(Counter counter, uint64_t value) {
+  if (enabled) {
+    auto& current = local().counters[counter];
+    if (current.load(std::memory_order_relaxed) < value) {
+      current.store(value, std::memory_order_relaxed);
+    }
+  }
+}
+
+uint64_t Statistics::total(Counter counter) {
+  std::lock_guard<std::mutex> lock(blocks_mutex);
+  uint64_t result = 0;
+  for (const auto& block : blocks) {
+    const uint64_t value = block->counters[counter].load(std::memory_order_relaxed);
+    // The largest counters are maximums over threads rather than sums
+    if (counter == LARGEST_MERGE_OUTPUT or counter == LARGEST_MEMORY_USE) {
+      result = std::max(result, value);
+    } else {
+      result += value;
+    }
+  }
+  return result;
+}
+
+void Statistics::write_json(std::ostream& out) {
+  uint64_t calls[TOTAL_PHASES] = {}, nanoseconds[TOTAL_PHASES] = {};
+  {
+    std::lock_guard<std::mutex> lock(blocks_mutex);
+    for (const auto& block : blocks) {
+      for (size_t p=0; p < TOTAL_PHASES; p++) {
+        calls[p] += block->phase_calls[p].load(std::memory_order_relaxed);
+        nanoseconds[p] += block->phase_nanoseconds[p].load(std::memory_order_relaxed);
+      }
+    }
+  }
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - enabled_at).count();
+  out << "{\n  \"elapsed_seconds\": " << (enabled ? elapsed : 0) << ",\n  \"counters\": {";
+  for (size_t c=0; c < TOTAL_COUNTERS; c++) {
+    out << (c ? ",\n" : "\n") << "    \"" << COUNTER_NAMES[c] << "\": " << total(Counter(c));
+  }
+  out << "\n  },\n  \"phases\": {";
+  for (size_t p=0; p < TOTAL_PHASES; p++) {
+    out << (p ? ",\n" : "\n") << "    \"" << PHASE_NAMES[p] << "\": {\"calls\": " << calls[p]
+        << ", \"seconds\": " << nanoseconds[p] * 1e-9 << "}";
+  }
+  out << "\n  }\n}\n";
+}
+
+void Statistics::write_json(const string& filename) {
+  const string temporary = filename + ".partial";
+  {
+    std::ofstream out(temporary);
+    if (not out) {
+      throw std::system_error(errno, std::generic_category(), "Unable to create '" + temporary + "'");
+    }
+    write_json(out);
+    out.close();
+    // Keep the previous report rather than replace it with a truncated one
+    if (not out) {
+      const int error = errno;
+      std::remove(temporary.c_str());
+      throw std::system_error(error, std::generic_category(), "Unable to write '" + temporary + "'");
+    }
+  }
+  if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+    throw std::system_error(errno, std::generic_category(), "Unable to create '" + filename + "'");
+  }
+}
+
+void Statistics::start_reporting(const string& filename, double interval_seconds) {
+  std::lock_guard<std::mutex> lock(reporting_mutex);
+  if (reporting) {
+    return;
+  }
+  reporting = true;
+  report_filename = filename;
+  const auto interval = std::chrono::duration<double>(interval_seconds);
+  reporter = std::thread([interval] {
+    std::unique_lock<std::mutex> lock(reporting_mutex);
+    // An exception escaping this thread would end the process, so failures are
+    // logged instead. Only the first of a run of failures is logged.
+    bool failing = false;
+    while (not reporting_wake.wait_for(lock, interval, [] { return not reporting; })) {
+      try {
+        write_json(report_filename);
+        failing = false;
+      } catch (const std::exception& error) {
+        if (not failing) {
+          LOG(LOG_WARNING) << "Unable to write statistics: " << error.what();
+        }
+        failing = true;
+      }
+    }
+  });
+}
+
+void Statistics::stop_reporting() {
+  {
+    std::lock_guard<std::mutex> lock(reporting_mutex);
+    if (not reporting) {
+      return;
+    }
+    reporting = false;
+  }
+  reporting_wake.notify_all();
+  reporter.join();
+}
@@ -0,0 +1,129 @@
+// Counts and times what the solver does, for reporting as JSON.
+// Every thread adds to its own copy of the counters, which only that thread
+// writes, so counting never contends between threads. When statistics are
+// disabled each call is a single well predicted branch.
+#ifndef STATISTICS_H_
+#define STATISTICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+using std::string;
+
+enum Counter {
+  // Passes over the "knowledge_propagate" worklist
+  PROPAGATION_ROUNDS,
+  // DNFs processed by "knowledge_propagate"
+  DNFS_VISITED,
+  // DNFs processed while propagating an assumption
+  ASSUMPTION_DNFS_VISITED,
+  // These count only what the problem keeps, not work under an assumption or
+  // speculation that parallel propagation throws away and redoes.
+  // Rows the problem's functions lost to "apply_knowledge"
+  ROWS_REMOVED,
+  // Satisfiable functions the problem learned from with "create_knowledge",
+  // and the assignments and rewrites they produced
+  KNOWLEDGE_CREATED,
+  FACTS_LEARNED,
+  ASSUMPTIONS_TESTED,
+  ASSUMPTIONS_REFUTED,
+  MERGES,
+  MERGE_INPUT_ROWS,
+  MERGE_OUTPUT_ROWS,
+  LARGEST_MERGE_OUTPUT,
+  // Merges "heuristic_merge" skipped for exceeding the row limit
+  MERGES_REFUSED,
+  // Most memory the problem held when "heuristic_merge" started, in bytes
+  LARGEST_MEMORY_USE,
+  // Functions removed for being identical to another
+  DUPLICATES_REMOVED,
+  TOTAL_COUNTERS
+};
+
+// Phases can nest, such as "knowledge_propagate" inside "assume_and_learn",
+// in which case both are charged for the inner time
+enum Phase {
+  LOAD_PHASE,
+  KNOWLEDGE_PROPAGATE_PHASE,
+  ASSUME_AND_LEARN_PHASE,
+  MERGE_PHASE,
+  CHECKPOINT_PHASE,
+  TOTAL_PHASES
+};
+
+class Statistics {
+ public:
+  // Also starts the clock for the report's elapsed time
+  static void enable();
+  static bool is_enabled() {
+    return enabled;
+  }
+  static void add(Counter counter, uint64_t amount=1) {
+    if (enabled) {
+      bump(local().counters[counter], amount);
+    }
+  }
+  // Raises "counter" to "value" if it is smaller
+  static void maximum(Counter counter, uint64_t value);
+  static void add_time(Phase phase, uint64_t nanoseconds) {
+    if (enabled) {
+      auto& block = local();
+      bump(block.phase_calls[phase], 1);
+      bump(block.phase_nanoseconds[phase], nanoseconds);
+    }
+  }
+  // Totals over every thread, or the maximum for the "LARGEST_" counters
+  static uint64_t total(Counter counter);
+  static void write_json(std::ostream& out);
+  // Writes the report to "filename", replacing it only once the new report is complete
+  static void write_json(const string& filename);
+  // Rewrites the report to "filename" every "interval_seconds" until "stop_reporting"
+  static void start_reporting(const string& filename, double interval_seconds);
+  static void stop_reporting();
+
+ private:
+  static bool enabled;
+  struct Block {
+    std::atomic<uint64_t> counters[TOTAL_COUNTERS];
+    std::atomic<uint64_t> phase_calls[TOTAL_PHASES];
+    std::atomic<uint64_t> phase_nanoseconds[TOTAL_PHASES];
+    Block();
+  };
+  static Block& local();
+  // Every thread's block, which outlive their threads so nothing is lost when one exits
+  static std::mutex blocks_mutex;
+  static std::vector<std::unique_ptr<Block>> blocks;
+  // Only the owning thread writes a block, so this needs no atomic read-modify-write
+  static void bump(std::atomic<uint64_t>& value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+  }
+};
+
+// Adds the time from construction to destruction to "phase"
+class PhaseTimer {
+ public:
+  explicit PhaseTimer(Phase phase_) : phase(phase_), timing(Statistics::is_enabled()) {
+    if (timing) {
+      start = std::chrono::steady_clock::now();
+    }
+  }
+  ~PhaseTimer() {
+    if (timing) {
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      Statistics::add_time(phase, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+  }
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+ private:
+  Phase phase;
+  bool timing;
+  std::chrono::steady_clock::time_point start;
+};
+
+#endif /* STATISTICS_H_ */
@@ -0,0 +1,144 @@
+#include "ThreadPool.h"
+#include <memory>
+#include <cassert>
+
+// True on pool workers and on a thread currently running a parallel loop
+thread_local bool inside_pool = false;
+// Set once on each pool worker
+thread_local size_t current_worker = 0;
+
+ThreadPool::ThreadPool(size_t total_threads) : ranges(total_threads) {
+  for (size_t i=1; i < total_threads; i++) {
+    workers.emplace_back(&ThreadPool::work, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+uint64_t pack_range(uint64_t begin, uint64_t end) {
+  return begin | (end << 32);
+}
+
+bool ThreadPool::take(size_t index, size_t& taken) {
+  auto& bounds = ranges[index].bounds;
+  uint64_t current = bounds.load();
+  while (true) {
+    const uint64_t begin = current & UINT32_MAX, end = current >> 32;
+    if (begin >= end) {
+      return false;
+    }
+    if (bounds.compare_exchange_weak(current, pack_range(begin + 1, end))) {
+      taken = begin;
+      return true;
+    }
+  }
+}
+
+bool ThreadPool::steal(size_t index) {
+  for (size_t offset=1; offset < ranges.size(); offset++) {
+    auto& victim = ranges[(index + offset) % ranges.size()].bounds;
+    uint64_t current = victim.load();
+    while (true) {
+      const uint64_t begin = current & UINT32_MAX, end = current >> 32;
+      if (begin >= end) {
+        break;
+      }
+      // Take the back half, leaving the victim the front it is working through
+      const uint64_t middle = begin + (end - begin) / 2;
+      if (victim.compare_exchange_weak(current, pack_range(begin, middle))) {
+        ranges[index].bounds.store(pack_range(middle, end));
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run_job(const std::function<void(size_t)>& body, size_t index) {
+  size_t i;
+  do {
+    while (take(index, i)) {
+      body(i);
+    }
+  } while (steal(index));
+}
+
+void ThreadPool::work(size_t index) {
+  inside_pool = true;
+  current_worker = index;
+  size_t seen = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [&] { return stopping or generation != seen; });
+    if (stopping) {
+      return;
+    }
+    seen = generation;
+    const auto* body = job;
+    lock.unlock();
+    run_job(*body, index);
+    lock.lock();
+    if (--busy == 0) {
+      finished.notify_all();
+    }
+  }
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& body) {
+  if (workers.empty() or count < 2 or inside_pool) {
+    for (size_t i=0; i < count; i++) {
+      body(i);
+    }
+    return;
+  }
+  assert(count <= UINT32_MAX);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = &body;
+    // Split the indices evenly, with thread "t" starting at t * count / threads
+    const size_t threads = ranges.size();
+    for (size_t t=0; t < threads; t++) {
+      ranges[t].bounds.store(pack_range(t * count / threads, (t + 1) * count / threads));
+    }
+    busy = workers.size();
+    generation++;
+  }
+  wake.notify_all();
+  inside_pool = true;
+  run_job(body, 0);
+  inside_pool = false;
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [&] { return busy == 0; });
+  job = nullptr;
+}
+
+size_t ThreadPool::worker_index() {
+  return current_worker;
+}
+
+std::unique_ptr<ThreadPool>& global_pool() {
+  static std::unique_ptr<ThreadPool> pool;
+  return pool;
+}
+
+ThreadPool& ThreadPool::global() {
+  auto& pool = global_pool();
+  if (not pool) {
+    size_t cores = std::thread::hardware_concurrency();
+    pool.reset(new ThreadPool(cores > 0 ? cores : 1));
+  }
+  return *pool;
+}
+
+void ThreadPool::set_global_size(size_t total_threads) {
+  global_pool().reset(new ThreadPool(total_threads > 0 ? total_threads : 1));
+}
@@ -0,0 +1,64 @@
+// A fixed set of worker threads used to run loops in parallel.
+// The thread calling "parallel_for" also does work, and calls made
+// from inside a running loop are run serially to avoid deadlock.
+// Each thread starts with an equal share of the loop's indices, and a thread
+// that runs out steals half of what remains from another thread.
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using std::size_t;
+
+class ThreadPool {
+ public:
+  // "total_threads" includes the calling thread, so 1 means everything is serial
+  explicit ThreadPool(size_t total_threads);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  size_t size() const {
+    return workers.size() + 1;
+  }
+  // Calls "body(i)" for every i in [0, count), returning when all calls have finished
+  void parallel_for(size_t count, const std::function<void(size_t)>& body);
+
+  // Which thread is running the current loop iteration, in [0, size()).
+  // The thread that called "parallel_for" is 0, as is any thread outside a pool.
+  static size_t worker_index();
+
+  // The pool shared by the whole solver, which defaults to one thread per core
+  static ThreadPool& global();
+  // Must not be called while the global pool is running a loop
+  static void set_global_size(size_t total_threads);
+ private:
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake, finished;
+  // The loop currently being run, protected by "mutex"
+  const std::function<void(size_t)>* job = nullptr;
+  size_t generation = 0;
+  size_t busy = 0;
+  bool stopping = false;
+  // The indices [begin, end) a thread has left, packed as begin | end << 32 so
+  // owners and thieves can both update it with a single compare-and-swap.
+  // Padded so each range is on its own cache line.
+  struct Range {
+    std::atomic<uint64_t> bounds;
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+  std::vector<Range> ranges;
+  void work(size_t index);
+  void run_job(const std::function<void(size_t)>& body, size_t index);
+  // Takes the next index from "ranges[index]", returning false if it is empty
+  bool take(size_t index, size_t& taken);
+  // Moves half of another thread's range into "ranges[index]"
+  bool steal(size_t index);
+};
+
+#endif /* THREADPOOL_H_ */
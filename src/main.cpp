@@ -1,69 +1,113 @@
 // Brian Goldman
 
 #include <iostream>
+#include <stdexcept>
 using namespace std;
+#include "Log.h"
 #include "Problem.h"
+#include "Statistics.h"
+#include "ThreadPool.h"
 
-// This is a heuristic I have for picking what to merge
-bool second_better(const std::shared_ptr<DNF>& first, const std::shared_ptr<DNF>& second) {
-  if (first->get_table().size() > 100 or second->get_table().size() > 100) {
-    return first->get_table().size() > second->get_table().size();
-  } else if (first->get_variables().size() < second->get_variables().size()) {
-    return true;
-  } else if (first->get_variables().size() > second->get_variables().size()) {
-    return false;
-  } else {
-    return first->get_table().size() > second->get_table().size();
+// Reads a number of bytes, optionally followed by K, M or G for powers of 1024
+size_t parse_bytes(const string& text) {
+  size_t used = 0;
+  size_t bytes = std::stoull(text, &used);
+  const string suffix = text.substr(used);
+  if (suffix == "K") {
+    bytes <<= 10;
+  } else if (suffix == "M") {
+    bytes <<= 20;
+  } else if (suffix == "G") {
+    bytes <<= 30;
+  } else if (not suffix.empty()) {
+    throw std::invalid_argument("Unknown size suffix in '" + text + "'");
   }
+  return bytes;
 }
 
-void heuristic_merge(Problem& problem) {
-  auto first = *problem.dnfs.begin();
-  for (const auto new_first : problem.dnfs) {
-    if (second_better(first, new_first)) {
-      first = new_first;
-    }
-  }
-  auto second = *problem.dnfs.begin();
-  for (const auto new_second : problem.dnfs) {
-    if (second == new_second) {
-      second = new_second;
-    } else if (new_second != first and second_better(second, new_second)) {
-      second = new_second;
+int main(int argc, char * argv[]) {
+  string filename, save_filename, resume_filename, stats_filename;
+  double stats_interval = 0;
+  size_t max_merge_rows = NO_ROW_LIMIT;
+  size_t memory_budget = NO_MEMORY_LIMIT;
+  for (int i=1; i < argc; i++) {
+    string argument = argv[i];
+    if (argument == "--threads" and i + 1 < argc) {
+      ThreadPool::set_global_size(std::stoul(argv[++i]));
+    } else if (argument == "--save-checkpoint" and i + 1 < argc) {
+      save_filename = argv[++i];
+    } else if (argument == "--resume" and i + 1 < argc) {
+      resume_filename = argv[++i];
+    } else if (argument == "--stats" and i + 1 < argc) {
+      stats_filename = argv[++i];
+    } else if (argument == "--stats-interval" and i + 1 < argc) {
+      stats_interval = std::stod(argv[++i]);
+    } else if (argument == "--max-merge-rows" and i + 1 < argc) {
+      max_merge_rows = std::stoull(argv[++i]);
+    } else if (argument == "--memory-budget" and i + 1 < argc) {
+      memory_budget = parse_bytes(argv[++i]);
+    } else if (argument == "--log-level" and i + 1 < argc) {
+      Log::set_level(Log::parse_level(argv[++i]));
+    } else {
+      filename = argument;
     }
   }
-  std::weak_ptr<DNF> weak_first = first;
-  std::weak_ptr<DNF> weak_second = second;
-  problem.merge(weak_first, weak_second);
-}
-
-int main(int argc, char * argv[]) {
-  if (argc < 2) {
-    cout << "Must specify an input file" << endl;
+  if (filename.empty() and resume_filename.empty()) {
+    LOG(LOG_ERROR) << "Must specify an input file";
     return 1;
   }
+  if (not stats_filename.empty()) {
+    Statistics::enable();
+    if (stats_interval > 0) {
+      Statistics::start_reporting(stats_filename, stats_interval);
+    }
+  }
   Problem problem;
-  problem.load(argv[1]);
-  problem.print_short(std::cout);
-  cout << "Problem load complete" << endl;
-  problem.knowledge_propagate();
-  problem.sanity_check();
-  problem.global_knowledge.print();
-  problem.print_short(std::cout);
-  cout << "Finished normal propagate" << endl;
-  cout << "Starting assume-and-learn" << endl;
-  problem.assume_and_learn();
-  problem.sanity_check();
-  cout << "Finished first assume-and-learn" << endl;
+  problem.max_merge_rows = max_merge_rows;
+  problem.memory_budget = memory_budget;
+  if (not resume_filename.empty()) {
+    // The checkpoint already has the first propagate and assume-and-learn done
+    problem.load_checkpoint(resume_filename);
+    problem.log_short(LOG_INFO);
+    LOG(LOG_INFO) << "Checkpoint load complete";
+  } else {
+    problem.load(filename);
+    problem.log_short(LOG_INFO);
+    LOG(LOG_INFO) << "Problem load complete";
+    problem.knowledge_propagate();
+    problem.sanity_check();
+    if (Log::enabled(LOG_DEBUG)) {
+      LogLine line(LOG_DEBUG);
+      problem.global_knowledge.print(line.stream());
+    }
+    problem.log_short(LOG_INFO);
+    LOG(LOG_INFO) << "Finished normal propagate";
+    LOG(LOG_INFO) << "Starting assume-and-learn";
+    problem.assume_and_learn();
+    problem.sanity_check();
+    LOG(LOG_INFO) << "Finished first assume-and-learn";
+  }
+  if (not save_filename.empty()) {
+    problem.save_checkpoint(save_filename);
+    LOG(LOG_INFO) << "Saved checkpoint to " << save_filename;
+  }
 
   for (size_t i=0; problem.dnfs.size() > 0 and i < 1000; i++) {
-    heuristic_merge(problem);
+    if (not problem.heuristic_merge()) {
+      break;
+    }
     problem.knowledge_propagate();
     problem.assume_and_learn();
   }
   problem.sanity_check();
-  cout << "Finished merge+assume-and-learn" << endl;
+  LOG(LOG_INFO) << "Finished merge+assume-and-learn";
+  // The results go to stdout, after the log on stderr
+  Log::flush();
   problem.global_knowledge.print();
   problem.print();
+  if (not stats_filename.empty()) {
+    Statistics::stop_reporting();
+    Statistics::write_json(stats_filename);
+  }
   return 0;
 }
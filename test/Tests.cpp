@@ -0,0 +1,787 @@
+// Checks the solver's parts against simple reference implementations on seeded
+// random inputs. Every failed check is printed, and the exit status is nonzero
+// if there were any.
+//
+// Usage: tests [--seed N] [--filter TEXT]
+
+#include "../src/ColumnKernel.h"
+#include "../src/DNF.h"
+#include "../src/Knowledge.h"
+#include "../src/Log.h"
+#include "../src/MappedFile.h"
+#include "../src/Problem.h"
+#include "../src/PropagationContext.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include <unistd.h>
+using std::string;
+using std::vector;
+
+size_t failures = 0;
+
+void check(bool passed, const char* condition, const char* file, int line) {
+  if (not passed) {
+    failures++;
+    std::cerr << file << ":" << line << ": check failed: " << condition << std::endl;
+  }
+}
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+// Each variable's state in "knowledge", as text, so two can be compared and printed
+string describe(const Knowledge& knowledge, size_t variables) {
+  if (knowledge.is_unsat) {
+    return "unsat";
+  }
+  string result;
+  for (size_t v=1; v <= variables; v++) {
+    if (knowledge.is_assigned(v)) {
+      result += std::to_string(v) + "=" + std::to_string(knowledge.value(v)) + " ";
+    } else if (knowledge.is_rewritten(v)) {
+      const auto rewrite = knowledge.rewrite(v);
+      result += std::to_string(v) + (rewrite.negated ? "=!" : "=") + std::to_string(rewrite.to) + " ";
+    }
+  }
+  return result;
+}
+
+// A function of between 2 and "max_variables" distinct variables from [1, pool]
+// with up to "max_rows" distinct rows. Some columns are made constant, copies or
+// inverses of another, so there is something to learn.
+DNF random_dnf(std::mt19937_64& random, size_t pool, size_t max_variables, size_t max_rows) {
+  const size_t count = std::min(pool, 2 + random() % (max_variables - 1));
+  vector<size_t> variables;
+  while (variables.size() < count) {
+    const size_t v = 1 + random() % pool;
+    if (std::find(variables.begin(), variables.end(), v) == variables.end()) {
+      variables.push_back(v);
+    }
+  }
+  // 0 is free, 1 is constant, 2 copies column 0, 3 inverts column 0
+  vector<int> kind(count);
+  for (size_t c=1; c < count; c++) {
+    kind[c] = random() % 6 < 3 ? 0 : 1 + random() % 3;
+  }
+  std::set<vector<bool>> rows;
+  const size_t wanted = 1 + random() % max_rows;
+  for (size_t attempt=0; attempt < 4 * wanted and rows.size() < wanted; attempt++) {
+    vector<bool> row(count);
+    for (size_t c=0; c < count; c++) {
+      row[c] = kind[c] == 0 ? random() & 1 : kind[c] == 1 ? true : kind[c] == 2 ? row[0] : not row[0];
+    }
+    rows.insert(row);
+  }
+  vector<vector<bool>> table(rows.begin(), rows.end());
+  std::shuffle(table.begin(), table.end(), random);
+  return DNF(variables, table);
+}
+
+// What "create_knowledge" should learn, found by comparing every pair of columns row by row
+Knowledge reference_knowledge(const DNF& dnf) {
+  Knowledge knowledge;
+  const auto& variables = dnf.get_variables();
+  vector<bool> constant(variables.size(), true);
+  for (size_t c=0; c < variables.size(); c++) {
+    for (size_t r=1; r < dnf.total_rows(); r++) {
+      constant[c] = constant[c] and dnf.get(r, c) == dnf.get(0, c);
+    }
+    if (constant[c]) {
+      knowledge.add(variables[c], dnf.get(0, c));
+    }
+  }
+  for (size_t x=0; x < variables.size(); x++) {
+    for (size_t y=x + 1; y < variables.size(); y++) {
+      if (constant[x] or constant[y]) {
+        continue;
+      }
+      bool equal = true, opposite = true;
+      for (size_t r=0; r < dnf.total_rows(); r++) {
+        equal = equal and dnf.get(r, x) == dnf.get(r, y);
+        opposite = opposite and dnf.get(r, x) != dnf.get(r, y);
+      }
+      if (equal or opposite) {
+        knowledge.add(TwoConsistency(variables[x], variables[y], opposite));
+      }
+    }
+  }
+  return knowledge;
+}
+
+// Treats each column "c" as variable c + 1
+Knowledge relations_knowledge(const ColumnRelations& found) {
+  Knowledge knowledge;
+  for (size_t c=0; c < found.constant.size(); c++) {
+    if (found.constant[c] != -1) {
+      knowledge.add(c + 1, found.constant[c]);
+    }
+  }
+  for (const auto& relation : found.relations) {
+    knowledge.add(TwoConsistency(relation.first + 1, relation.second + 1, relation.negated));
+  }
+  return knowledge;
+}
+
+// Every kernel the CPU supports
+vector<const ColumnKernel*> kernels() {
+  vector<const ColumnKernel*> result = {&scalar_kernel()};
+  if (sse4_kernel()) {
+    result.push_back(sse4_kernel());
+  }
+  if (avx2_kernel()) {
+    result.push_back(avx2_kernel());
+  }
+  return result;
+}
+
+// Each kernel against a bit by bit count and comparison, for lengths covering every tail
+void test_column_kernels(std::mt19937_64& random) {
+  for (size_t trial=0; trial < 2000; trial++) {
+    const size_t words = 1 + trial % 40;
+    vector<uint64_t> a(words), b(words), mask(words);
+    for (size_t w=0; w < words; w++) {
+      a[w] = random();
+      mask[w] = trial % 3 == 0 ? ~uint64_t(0) : random() & random();
+    }
+    // Mostly equal or opposite columns, so comparisons do not always stop early
+    const int shape = random() % 3;
+    for (size_t w=0; w < words; w++) {
+      b[w] = shape == 0 ? random() : shape == 1 ? a[w] : ~a[w];
+    }
+    if (shape != 0 and random() & 1) {
+      const size_t bit = random() % (64 * words);
+      b[bit / 64] ^= uint64_t(1) << (bit % 64);
+    }
+    size_t ones = 0;
+    bool differ = false, match = false;
+    for (size_t bit=0; bit < 64 * words; bit++) {
+      const uint64_t selected = (mask[bit / 64] >> (bit % 64)) & 1;
+      if (selected) {
+        ones += (a[bit / 64] >> (bit % 64)) & 1;
+        const bool same = ((a[bit / 64] ^ b[bit / 64]) >> (bit % 64) & 1) == 0;
+        differ = differ or not same;
+        match = match or same;
+      }
+    }
+    const unsigned expected = (differ ? COLUMNS_DIFFER : 0) | (match ? COLUMNS_MATCH : 0);
+    for (const auto kernel : kernels()) {
+      CHECK(kernel->count(a.data(), mask.data(), words) == ones);
+      CHECK(kernel->compare(a.data(), b.data(), mask.data(), words) == expected);
+    }
+  }
+}
+
+// Both ways of finding column relations, with each kernel, learn what comparing every pair row by row does
+void test_column_relations(std::mt19937_64& random) {
+  for (size_t trial=0; trial < 500; trial++) {
+    const DNF dnf = random_dnf(random, 40, 24, 600);
+    const size_t columns = dnf.get_variables().size();
+    const size_t words = (dnf.total_rows() + 63) / 64;
+    vector<uint64_t> table(columns * words, 0), mask(words, 0);
+    for (size_t r=0; r < dnf.total_rows(); r++) {
+      for (size_t c=0; c < columns; c++) {
+        table[c * words + r / 64] |= uint64_t(dnf.get(r, c)) << (r % 64);
+      }
+    }
+    // Some selected row is needed for the relations to be meaningful
+    vector<size_t> selected_rows;
+    for (size_t r=0; r < dnf.total_rows(); r++) {
+      if (r == 0 or random() % 4) {
+        mask[r / 64] |= uint64_t(1) << (r % 64);
+        selected_rows.push_back(r);
+      }
+    }
+    // The reference only sees the selected rows
+    vector<vector<bool>> selected;
+    for (const auto r : selected_rows) {
+      vector<bool> row(columns);
+      for (size_t c=0; c < columns; c++) {
+        row[c] = dnf.get(r, c);
+      }
+      selected.push_back(row);
+    }
+    vector<size_t> numbered(columns);
+    for (size_t c=0; c < columns; c++) {
+      numbered[c] = c + 1;
+    }
+    const string expected = describe(reference_knowledge(DNF(numbered, selected)), columns);
+    for (const auto kernel : kernels()) {
+      const auto all_pairs = all_pairs_relations(*kernel, table.data(), columns, words, mask.data());
+      const auto hashed = hashed_relations(*kernel, table.data(), columns, words, mask.data());
+      CHECK(describe(relations_knowledge(all_pairs), columns) == expected);
+      CHECK(describe(relations_knowledge(hashed), columns) == expected);
+    }
+  }
+}
+
+// Every front-end learns the same knowledge as the reference, for small and table functions
+void test_create_knowledge(std::mt19937_64& random) {
+  for (size_t trial=0; trial < 2000; trial++) {
+    const DNF dnf = random_dnf(random, 30, trial % 2 ? 6 : 20, 300);
+    const string expected = describe(reference_knowledge(dnf), 30);
+    CHECK(describe(dnf.create_knowledge(), 30) == expected);
+    CHECK(describe(dnf.create_knowledge_alternate(), 30) == expected);
+    vector<uint64_t> mask(dnf.mask_words());
+    dnf.fill_mask(mask.data());
+    CHECK(describe(dnf.create_knowledge(mask.data()), 30) == expected);
+  }
+}
+
+// Up to three random facts about variables from [1, pool]
+Knowledge random_knowledge(std::mt19937_64& random, size_t pool) {
+  Knowledge knowledge;
+  const size_t facts = 1 + random() % 3;
+  for (size_t f=0; f < facts; f++) {
+    const size_t x = 1 + random() % pool;
+    const size_t y = 1 + random() % pool;
+    if (random() & 1) {
+      knowledge.add(x, random() & 1);
+    } else if (x != y) {
+      knowledge.add(TwoConsistency(x, y, random() & 1));
+    }
+  }
+  return knowledge;
+}
+
+// True if row "row" of "dnf" agrees with "knowledge": assigned variables have
+// their values, and variables rewritten to the same variable are consistent
+bool consistent(const Knowledge& knowledge, const DNF& dnf, size_t row) {
+  const auto& variables = dnf.get_variables();
+  // The value each variable a column is rewritten to must take in this row
+  std::map<size_t, bool> targets;
+  for (size_t c=0; c < variables.size(); c++) {
+    const size_t v = variables[c];
+    const bool value = dnf.get(row, c);
+    if (knowledge.is_assigned(v)) {
+      if (knowledge.value(v) != value) {
+        return false;
+      }
+      continue;
+    }
+    size_t target = v;
+    bool target_value = value;
+    if (knowledge.is_rewritten(v)) {
+      const auto rewrite = knowledge.rewrite(v);
+      target = rewrite.to;
+      target_value = value != rewrite.negated;
+    }
+    const auto found = targets.insert({target, target_value});
+    if (found.first->second != target_value) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Each row as the value of each variable, so functions with their columns in different orders compare equal
+std::set<std::map<size_t, bool>> rows_by_variable(const DNF& dnf) {
+  std::set<std::map<size_t, bool>> result;
+  for (size_t r=0; r < dnf.total_rows(); r++) {
+    std::map<size_t, bool> row;
+    for (size_t c=0; c < dnf.get_variables().size(); c++) {
+      row[dnf.get_variables()[c]] = dnf.get(r, c);
+    }
+    result.insert(row);
+  }
+  return result;
+}
+
+// A lazy merge counts, learns and applies knowledge as the merge it stands for,
+// and an assumption's mask over its inputs never learns anything the merged rows
+// it keeps contradict
+void test_lazy_merge(std::mt19937_64& random) {
+  const size_t lazy_merge_rows = DNF::lazy_merge_rows;
+  DNF::lazy_merge_rows = 0;
+  for (size_t trial=0; trial < 2000; trial++) {
+    const size_t pool = 8 + random() % 12;
+    const DNF a = random_dnf(random, pool, 9, 40);
+    const DNF b = random_dnf(random, pool, 9, 40);
+    DNF eager = DNF::merge(a, b), lazy;
+    CHECK(DNF::try_lazy_merge(a, b, ~size_t(0), lazy));
+    if (not lazy.is_lazy()) {
+      continue;
+    }
+    CHECK(lazy.get_variables() == eager.get_variables());
+    CHECK(lazy.total_rows() == eager.total_rows());
+    for (size_t c=0; c < eager.get_variables().size(); c++) {
+      CHECK(lazy.column_ones(c) == eager.column_ones(c));
+    }
+    if (eager.total_rows() == 0) {
+      continue;
+    }
+    CHECK(describe(lazy.create_knowledge(), pool) == describe(eager.create_knowledge(), pool));
+
+    const Knowledge assumption = random_knowledge(random, pool);
+    if (assumption.is_unsat) {
+      continue;
+    }
+    vector<uint64_t> mask(lazy.mask_words());
+    lazy.fill_mask(mask.data());
+    lazy.restrict(assumption, mask.data());
+    const Knowledge learned = lazy.create_knowledge(mask.data());
+    vector<size_t> kept;
+    for (size_t r=0; r < eager.total_rows(); r++) {
+      if (consistent(assumption, eager, r)) {
+        kept.push_back(r);
+      }
+    }
+    CHECK(not learned.is_unsat or kept.empty());
+    if (not learned.is_unsat) {
+      for (const auto r : kept) {
+        CHECK(consistent(learned, eager, r));
+      }
+    }
+
+    const Knowledge knowledge = random_knowledge(random, pool);
+    if (knowledge.is_unsat) {
+      continue;
+    }
+    CHECK(lazy.apply_knowledge(knowledge) == eager.apply_knowledge(knowledge));
+    CHECK(lazy.total_rows() == eager.total_rows());
+    if (eager.total_rows() > 0) {
+      CHECK(describe(lazy.create_knowledge(), pool) == describe(eager.create_knowledge(), pool));
+    }
+    // Substituting can leave the columns in another order
+    lazy.materialize();
+    CHECK(rows_by_variable(lazy) == rows_by_variable(eager));
+  }
+  DNF::lazy_merge_rows = lazy_merge_rows;
+}
+
+// Inputs too small to be sampled get an exact estimate, whichever comes first
+void test_merge_estimate(std::mt19937_64& random) {
+  for (size_t trial=0; trial < 2000; trial++) {
+    const size_t pool = 6 + random() % 10;
+    const DNF a = random_dnf(random, pool, 9, 200);
+    const DNF b = random_dnf(random, pool, 9, 200);
+    CHECK(DNF::estimate_merge_rows(a, b) == DNF::merge(a, b).total_rows());
+    CHECK(DNF::estimate_merge_rows(a, b) == DNF::estimate_merge_rows(b, a));
+  }
+}
+
+// Which DNFs in "arena" use each of the variables [1, pool]
+vector<vector<dnf_handle>> variable_index(const DNFArena& arena, size_t pool) {
+  vector<vector<dnf_handle>> result(pool + 1);
+  for (const auto handle : arena.live()) {
+    for (const auto v : arena[handle].get_variables()) {
+      result[v].push_back(handle);
+    }
+  }
+  return result;
+}
+
+// A context that propagated before a DNF was changed in place learns the same as
+// a new one, so none of its row masks are read against the wrong rows
+void test_row_masks(std::mt19937_64& random) {
+  // Making 7 a copy of 1 turns two rows over 7 variables into a truth table
+  // with two rows, which also needs one mask word
+  {
+    DNFArena arena;
+    const auto handle = arena.insert(DNF({1, 2, 3, 4, 5, 6, 7}, {vector<bool>(7, false), vector<bool>(7, true)}));
+    auto variable_to_dnfs = variable_index(arena, 7);
+    PropagationContext context(arena, variable_to_dnfs);
+    context.push();
+    context.assume(2, true);
+    context.propagate();
+    context.pop();
+    Knowledge copy;
+    copy.add(TwoConsistency(1, 7, false));
+    CHECK(arena[handle].apply_knowledge(copy));
+    CHECK(arena[handle].is_small() and arena[handle].total_rows() == 2 and arena[handle].mask_words() == 1);
+    variable_to_dnfs = variable_index(arena, 7);
+    context.push();
+    context.assume(2, true);
+    context.propagate();
+    CHECK(not context.knowledge().is_unsat);
+    CHECK(context.knowledge().is_assigned(3) and context.knowledge().value(3));
+    context.pop();
+  }
+  const size_t lazy_merge_rows = DNF::lazy_merge_rows;
+  DNF::lazy_merge_rows = 0;
+  for (size_t trial=0; trial < 500; trial++) {
+    const size_t pool = 8 + random() % 8;
+    DNFArena arena;
+    for (size_t i=0; i < 3; i++) {
+      arena.insert(random_dnf(random, pool, 9, 40));
+    }
+    DNF lazy;
+    DNF::try_lazy_merge(random_dnf(random, pool, 9, 40), random_dnf(random, pool, 9, 40), ~size_t(0), lazy);
+    const auto joined = arena.insert(std::move(lazy));
+    auto variable_to_dnfs = variable_index(arena, pool);
+    PropagationContext reused(arena, variable_to_dnfs);
+    const Knowledge first = random_knowledge(random, pool);
+    if (first.is_unsat) {
+      continue;
+    }
+    reused.push();
+    reused.assume(first);
+    reused.propagate();
+    reused.pop();
+    // Change one DNF in place, through each way that keeps its handle
+    if (trial % 2 == 0 and arena[joined].is_lazy()) {
+      arena[joined].materialize();
+    } else {
+      const Knowledge knowledge = random_knowledge(random, pool);
+      if (knowledge.is_unsat) {
+        continue;
+      }
+      arena[arena.live()[random() % arena.size()]].apply_knowledge(knowledge);
+    }
+    variable_to_dnfs = variable_index(arena, pool);
+    const Knowledge second = random_knowledge(random, pool);
+    if (second.is_unsat) {
+      continue;
+    }
+    PropagationContext fresh(arena, variable_to_dnfs);
+    for (auto context : {&reused, &fresh}) {
+      context->push();
+      context->assume(second);
+      context->propagate();
+    }
+    CHECK(describe(reused.knowledge(), pool) == describe(fresh.knowledge(), pool));
+  }
+  DNF::lazy_merge_rows = lazy_merge_rows;
+}
+
+// One variable's state in "knowledge", as text
+string describe_variable(const Knowledge& knowledge, size_t v) {
+  if (knowledge.is_assigned(v)) {
+    return "=" + std::to_string(knowledge.value(v));
+  }
+  if (knowledge.is_rewritten(v)) {
+    const auto rewrite = knowledge.rewrite(v);
+    return (rewrite.negated ? "~!" : "~") + std::to_string(rewrite.to);
+  }
+  return "";
+}
+
+// "Knowledge::add" lists exactly the variables whose assignment or rewrite changed, once each
+void test_updated_variables(std::mt19937_64& random) {
+  const size_t pool = 24;
+  UpdatedVariables updated;
+  for (size_t trial=0; trial < 500; trial++) {
+    Knowledge knowledge;
+    for (size_t step=0; step < 30 and not knowledge.is_unsat; step++) {
+      vector<string> before;
+      for (size_t v=0; v <= pool; v++) {
+        before.push_back(describe_variable(knowledge, v));
+      }
+      updated.clear();
+      const size_t x = 1 + random() % pool;
+      const size_t y = 1 + random() % pool;
+      const int kind = random() % 4;
+      if (kind == 0) {
+        knowledge.add(x, random() & 1, &updated);
+      } else if (kind == 1 and x != y) {
+        knowledge.add(TwoConsistency(x, y, random() & 1), &updated);
+      } else {
+        knowledge.add(random_knowledge(random, pool), &updated);
+      }
+      if (knowledge.is_unsat) {
+        break;
+      }
+      vector<size_t> changed;
+      for (size_t v=0; v <= pool; v++) {
+        if (describe_variable(knowledge, v) != before[v]) {
+          changed.push_back(v);
+        }
+      }
+      vector<size_t> listed(updated.begin(), updated.end());
+      CHECK(listed.size() == updated.size());
+      std::sort(listed.begin(), listed.end());
+      CHECK(listed == changed);
+    }
+  }
+}
+
+// Writes a .dnf file of "functions" functions of 2 to 6 variables from [1, variables],
+// each of which is true for "planted" and roughly a quarter of the other positions
+string write_planted(std::mt19937_64& random, const vector<bool>& planted, size_t functions) {
+  const size_t variables = planted.size() - 1;
+  char filename[] = "/tmp/fastsat_testXXXXXX";
+  close(mkstemp(filename));
+  const string name = string(filename) + ".dnf";
+  std::rename(filename, name.c_str());
+  std::ofstream out(name);
+  out << "p dnf " << variables << " " << functions << "\nc planted\n";
+  for (size_t f=0; f < functions; f++) {
+    const size_t size = 2 + random() % 5;
+    vector<size_t> chosen;
+    while (chosen.size() < size) {
+      const size_t v = 1 + random() % variables;
+      if (std::find(chosen.begin(), chosen.end(), v) == chosen.end()) {
+        chosen.push_back(v);
+      }
+    }
+    uint64_t position = 0;
+    for (size_t i=0; i < size; i++) {
+      position |= uint64_t(planted[chosen[i]]) << i;
+    }
+    const uint64_t positions = size == 6 ? ~uint64_t(0) : (uint64_t(1) << (uint64_t(1) << size)) - 1;
+    const uint64_t table = (random() & random() & positions) | (uint64_t(1) << position);
+    out << "******* Big integer: " << table << " , Block size = " << size << "\n";
+    for (size_t i=0; i < size; i++) {
+      out << chosen[i] << (i + 1 < size ? " " : "\n");
+    }
+  }
+  return name;
+}
+
+// Solving, as the solver's main loop does, only learns facts the planted assignment satisfies
+void test_planted_solve(std::mt19937_64& random) {
+  size_t learned = 0;
+  for (size_t trial=0; trial < 20; trial++) {
+    const size_t variables = 20 + random() % 40;
+    vector<bool> planted(variables + 1);
+    for (size_t v=1; v <= variables; v++) {
+      planted[v] = random() & 1;
+    }
+    const string name = write_planted(random, planted, variables);
+    Problem problem;
+    problem.load(name);
+    std::remove(name.c_str());
+    problem.knowledge_propagate();
+    problem.assume_and_learn();
+    for (size_t i=0; problem.dnfs.size() > 0 and i < 1000; i++) {
+      if (not problem.heuristic_merge()) {
+        break;
+      }
+      problem.knowledge_propagate();
+      problem.assume_and_learn();
+    }
+    const auto& knowledge = problem.global_knowledge;
+    CHECK(not knowledge.is_unsat);
+    for (size_t v=1; v <= variables; v++) {
+      if (knowledge.is_assigned(v)) {
+        CHECK(knowledge.value(v) == planted[v]);
+      } else if (knowledge.is_rewritten(v)) {
+        const auto rewrite = knowledge.rewrite(v);
+        CHECK(planted[rewrite.from] == (planted[rewrite.to] != rewrite.negated));
+      }
+    }
+    learned += knowledge.assigned_count() + knowledge.rewrite_count();
+  }
+  // Otherwise nothing was checked
+  CHECK(learned > 0);
+}
+
+// "dnf" rebuilt from its rows, with its columns and rows shuffled, and without row "drop" if it has one
+DNF shuffled_copy(std::mt19937_64& random, const DNF& dnf, size_t drop=~size_t(0)) {
+  const auto& variables = dnf.get_variables();
+  vector<size_t> order(variables.size());
+  for (size_t c=0; c < order.size(); c++) {
+    order[c] = c;
+  }
+  std::shuffle(order.begin(), order.end(), random);
+  vector<size_t> shuffled_variables;
+  for (const auto c : order) {
+    shuffled_variables.push_back(variables[c]);
+  }
+  vector<vector<bool>> table;
+  for (size_t r=0; r < dnf.total_rows(); r++) {
+    if (r == drop) {
+      continue;
+    }
+    vector<bool> row;
+    for (const auto c : order) {
+      row.push_back(dnf.get(r, c));
+    }
+    table.push_back(row);
+  }
+  std::shuffle(table.begin(), table.end(), random);
+  return DNF(shuffled_variables, table);
+}
+
+// Functions are the same exactly when they have the same rows, whatever order
+// their columns and rows are in, and a kept hash is dropped when knowledge changes it
+void test_same_function(std::mt19937_64& random) {
+  for (size_t trial=0; trial < 2000; trial++) {
+    const DNF a = random_dnf(random, 12, trial % 2 ? 6 : 14, 200);
+    const DNF copy = shuffled_copy(random, a);
+    CHECK(a.function_hash() == copy.function_hash());
+    CHECK(DNF::same_function(a, copy));
+    if (a.total_rows() > 1) {
+      const DNF fewer = shuffled_copy(random, a, random() % a.total_rows());
+      CHECK(not DNF::same_function(a, fewer));
+    }
+    const DNF other = random_dnf(random, 12, trial % 2 ? 6 : 14, 200);
+    const auto& x = a.get_variables();
+    const auto& y = other.get_variables();
+    const bool same_rows = std::set<size_t>(x.begin(), x.end()) == std::set<size_t>(y.begin(), y.end())
+        and rows_by_variable(a) == rows_by_variable(other);
+    CHECK(DNF::same_function(a, other) == same_rows);
+
+    DNF changed = a;
+    changed.function_hash();
+    const Knowledge knowledge = random_knowledge(random, 12);
+    if (not knowledge.is_unsat and changed.apply_knowledge(knowledge)) {
+      CHECK(changed.function_hash() == shuffled_copy(random, changed).function_hash());
+    }
+  }
+}
+
+// Scopes are set, replaced and erased at random, with slots reused by new
+// handles, and every query agrees with comparing the sets directly
+void test_scope_index(std::mt19937_64& random) {
+  DNFArena arena;
+  ScopeIndex index;
+  std::map<dnf_handle, std::set<size_t>> model;
+  auto random_scope = [&]() {
+    vector<size_t> variables;
+    const size_t count = random() % 5;
+    for (size_t i=0; i < count; i++) {
+      variables.push_back(1 + random() % 12);
+    }
+    std::sort(variables.begin(), variables.end());
+    variables.erase(std::unique(variables.begin(), variables.end()), variables.end());
+    std::shuffle(variables.begin(), variables.end(), random);
+    return variables;
+  };
+  for (size_t step=0; step < 20000; step++) {
+    const int action = model.empty() ? 0 : random() % 3;
+    auto chosen = model.begin();
+    std::advance(chosen, model.empty() ? 0 : random() % model.size());
+    if (action == 0) {
+      const auto handle = arena.insert(DNF());
+      const auto variables = random_scope();
+      index.set(handle, variables);
+      model[handle] = std::set<size_t>(variables.begin(), variables.end());
+    } else if (action == 1) {
+      const auto variables = random_scope();
+      index.set(chosen->first, variables);
+      chosen->second = std::set<size_t>(variables.begin(), variables.end());
+    } else {
+      index.erase(chosen->first);
+      arena.erase(chosen->first);
+      model.erase(chosen);
+    }
+    if (model.empty()) {
+      continue;
+    }
+    const auto& query = *std::next(model.begin(), random() % model.size());
+    bool has_same = false, has_subset = false;
+    for (const auto& other : model) {
+      if (other.first == query.first) {
+        continue;
+      }
+      const bool inside = std::includes(query.second.begin(), query.second.end(), other.second.begin(), other.second.end());
+      CHECK(index.contains(query.first, other.first) == inside);
+      has_same = has_same or other.second == query.second;
+      has_subset = has_subset or (inside and not other.second.empty());
+    }
+    const auto same = index.find_same(query.first);
+    CHECK((same != NO_DNF) == has_same);
+    CHECK(same == NO_DNF or (same != query.first and model.at(same) == query.second));
+    const auto subset = index.find_subset(query.first);
+    CHECK((subset != NO_DNF) == has_subset);
+    if (subset != NO_DNF) {
+      const auto& found = model.at(subset);
+      CHECK(subset != query.first and not found.empty());
+      CHECK(std::includes(query.second.begin(), query.second.end(), found.begin(), found.end()));
+    }
+  }
+}
+
+// A table of as many rows as "rows_within" allows fits in the memory it was given,
+// along with the bytes each row needs elsewhere
+void test_rows_within(std::mt19937_64& random) {
+  for (size_t trial=0; trial < 60; trial++) {
+    const size_t columns = 7 + random() % 40;
+    const size_t bytes = random() % 200000;
+    const size_t row_bytes = trial % 3 == 0 ? 0 : random() % 64;
+    const size_t rows = DNF::rows_within(columns, bytes, row_bytes);
+    if (rows == 0) {
+      continue;
+    }
+    vector<size_t> variables(columns);
+    for (size_t c=0; c < columns; c++) {
+      variables[c] = c + 1;
+    }
+    vector<vector<bool>> table(rows, vector<bool>(columns));
+    for (auto& row : table) {
+      for (size_t c=0; c < columns; c++) {
+        row[c] = random() & 1;
+      }
+    }
+    const DNF dnf(variables, table);
+    CHECK(dnf.memory_bytes() + rows * row_bytes <= bytes);
+  }
+}
+
+// Words end at a comma, as the stream parsing before the scanner allowed
+void test_scanner(std::mt19937_64&) {
+  const string text = "******* Big integer: 0x1f, Block size = 3\n1 2 3\n";
+  Scanner in(text.data(), text.data() + text.size(), "text");
+  in.expect("*******");
+  in.expect("Big");
+  in.expect("integer:");
+  const auto big_int = in.read_big_integer();
+  CHECK(big_int.size() == 1 and big_int[0] == 0x1f);
+  in.expect(",");
+  in.expect("Block");
+  in.expect("size");
+  in.expect("=");
+  CHECK(in.read_unsigned() == 3);
+  in.next_line();
+  CHECK(in.read_unsigned() == 1);
+  const string spaced = "12 , 7,8";
+  Scanner words(spaced.data(), spaced.data() + spaced.size(), "spaced");
+  CHECK(words.read_unsigned() == 12);
+  words.expect(",");
+  CHECK(words.read_unsigned() == 7);
+  words.expect(",");
+  CHECK(words.read_unsigned() == 8);
+  CHECK(words.at_line_end());
+}
+
+int main(int argc, char * argv[]) {
+  uint64_t seed = 1;
+  string filter;
+  for (int i=1; i < argc; i++) {
+    const string argument = argv[i];
+    if (argument == "--seed" and i + 1 < argc) {
+      seed = std::stoull(argv[++i]);
+    } else if (argument == "--filter" and i + 1 < argc) {
+      filter = argv[++i];
+    } else {
+      std::cerr << "Unknown option " << argument << std::endl;
+      return 1;
+    }
+  }
+  Log::set_level(LOG_ERROR);
+  const vector<std::pair<string, std::function<void(std::mt19937_64&)>>> tests = {
+    {"column_kernels", test_column_kernels},
+    {"column_relations", test_column_relations},
+    {"create_knowledge", test_create_knowledge},
+    {"lazy_merge", test_lazy_merge},
+    {"row_masks", test_row_masks},
+    {"merge_estimate", test_merge_estimate},
+    {"updated_variables", test_updated_variables},
+    {"planted_solve", test_planted_solve},
+    {"same_function", test_same_function},
+    {"scope_index", test_scope_index},
+    {"rows_within", test_rows_within},
+    {"scanner", test_scanner},
+  };
+  for (const auto& test : tests) {
+    if (test.first.find(filter) == string::npos) {
+      continue;
+    }
+    const size_t before = failures;
+    std::mt19937_64 random(seed);
+    test.second(random);
+    std::cerr << test.first << (failures == before ? ": ok" : ": FAILED") << std::endl;
+  }
+  if (failures > 0) {
+    std::cerr << failures << " checks failed" << std::endl;
+    return 1;
+  }
+  return 0;
+}